@@ -0,0 +1,221 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+
+/* Глобальная куча против PoolMemoryResource под многопоточной отправкой.
+ *
+ * queue  - потоки отправителей копируют сообщения в BufferString и ставят
+ *          их в общую BufferQueue, один поток забирает их, как поток рассылки.
+ * server - потоки отправителей вызывают send_all(), простые хендлеры
+ *          клиентов читают рассылку.
+ * Для каждого источника выводится время на сообщение и число обращений
+ * к глобальной куче на сообщение: пул обращается к ней только за новыми кусками.
+ *
+ * Запуск: benchmark_alloc [потоков] [сообщений на поток] [размер сообщения] [клиентов]
+ */
+
+using namespace std;
+
+using Server = SimpleNamedPipe::NamedPipeServer;
+
+/* Глобальная куча со счетчиком обращений */
+class CountingResource : public SimpleNamedPipe::MemoryResource {
+public:
+    std::atomic<uint64_t> allocations;
+
+    CountingResource() : allocations(0) {}
+
+protected:
+    void *do_allocate(size_t bytes, size_t) override {
+        ++allocations;
+        return ::operator new(bytes);
+    }
+
+    void do_deallocate(void *p, size_t, size_t) override {
+        ::operator delete(p);
+    }
+
+    bool do_is_equal(const SimpleNamedPipe::MemoryResource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+static void print_result(
+        const char *title,
+        const char *resource_name,
+        const double seconds,
+        const uint64_t messages,
+        const uint64_t allocations) {
+    std::cout << title << " " << resource_name
+        << ": " << seconds / messages * 1e9 << " ns/msg"
+        << ", " << messages / seconds << " msg/s"
+        << ", heap allocations " << static_cast<double>(allocations) / messages << " per msg" << std::endl;
+}
+
+static void measure_queue(
+        const char *resource_name,
+        SimpleNamedPipe::MemoryResource *resource,
+        CountingResource &heap,
+        const size_t threads,
+        const size_t count,
+        const std::string &message) {
+    SimpleNamedPipe::BufferQueue queue{SimpleNamedPipe::ResourceAllocator<SimpleNamedPipe::BufferString>(resource)};
+    std::mutex mutex;
+    std::atomic<size_t> producers(threads);
+    const uint64_t start_allocations = heap.allocations;
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i = 0; i < count; ++i) {
+                SimpleNamedPipe::BufferString str(message.data(), message.size(),
+                    SimpleNamedPipe::ResourceAllocator<char>(resource));
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push(std::move(str));
+            }
+            --producers;
+        });
+    }
+    uint64_t consumed = 0;
+    SimpleNamedPipe::BufferString str{SimpleNamedPipe::ResourceAllocator<char>(resource)};
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty()) {
+                if (producers == 0) break;
+            } else {
+                str = std::move(queue.front());
+                queue.pop();
+                ++consumed;
+                continue;
+            }
+        }
+        std::this_thread::yield();
+    }
+    for (auto &worker : workers) worker.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    print_result("queue ", resource_name, seconds, consumed, heap.allocations - start_allocations);
+}
+
+static HANDLE open_pipe(const std::string &pipename) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        const HANDLE pipe = CreateFileA(
+            pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            SetNamedPipeHandleState(pipe, &mode, NULL, NULL);
+            return pipe;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY && GetLastError() != ERROR_FILE_NOT_FOUND) break;
+        WaitNamedPipeA(pipename.c_str(), 100);
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+static void measure_server(
+        const char *resource_name,
+        SimpleNamedPipe::MemoryResource *resource,
+        CountingResource &heap,
+        const size_t threads,
+        const size_t count,
+        const std::string &message,
+        const size_t clients) {
+    const std::string name(std::string("benchmark_alloc_") + resource_name);
+    Server server(name, message.size() + 64);
+    server.set_memory_resource(resource);
+    std::atomic<size_t> opened(0);
+    server.on_open = [&](Server::Connection*) {
+        ++opened;
+    };
+    server.on_message = [](Server::Connection*, const std::string &) {};
+    server.on_close = [](Server::Connection*) {};
+    server.on_error = [](Server::Connection*, const std::error_code &) {};
+    if (!server.start()) {
+        std::cout << "server " << resource_name << ": start failed" << std::endl;
+        return;
+    }
+    std::vector<HANDLE> pipes;
+    for (size_t i = 0; i < clients; ++i) {
+        const HANDLE pipe = open_pipe("\\\\.\\pipe\\" + name);
+        if (pipe != INVALID_HANDLE_VALUE) pipes.push_back(pipe);
+    }
+    while (opened < pipes.size()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const uint64_t total = threads * count;
+    const uint64_t start_allocations = heap.allocations;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> readers;
+    for (const HANDLE pipe : pipes) {
+        readers.emplace_back([&, pipe]() {
+            std::vector<char> buffer(message.size() + 64);
+            for (uint64_t i = 0; i < total; ++i) {
+                DWORD bytes = 0;
+                if (!ReadFile(pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, NULL)) break;
+            }
+        });
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            for (size_t i = 0; i < count; ++i) server.send_all(message);
+        });
+    }
+    for (auto &worker : workers) worker.join();
+    for (auto &reader : readers) reader.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const uint64_t allocations = heap.allocations - start_allocations;
+
+    for (const HANDLE pipe : pipes) CloseHandle(pipe);
+    server.stop();
+    print_result("server", resource_name, seconds, total, allocations);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t threads = argc > 1 ? std::stoul(argv[1]) : 4;
+    const size_t count = argc > 2 ? std::stoul(argv[2]) : 100000;
+    const size_t size = argc > 3 ? std::stoul(argv[3]) : 256;
+    const size_t clients = argc > 4 ? std::stoul(argv[4]) : 4;
+    const std::string message(size, 'x');
+
+    std::cout << "threads " << threads << ", messages per thread " << count
+        << ", size " << size << " bytes, clients " << clients << std::endl;
+
+    CountingResource heap;
+    SimpleNamedPipe::PoolMemoryResource pool(64 * 1024, &heap);
+    measure_queue("default", &heap, heap, threads, count, message);
+    measure_queue("pool   ", &pool, heap, threads, count, message);
+    measure_server("default", &heap, heap, threads, count, message, clients);
+    measure_server("pool", &pool, heap, threads, count, message, clients);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "named-pipe-compress.hpp"
+
+/* Пропускная способность и затраты процессора на сжатие по размерам сообщений.
+ * Сообщения - JSON одной структуры, словарь обучен на других сообщениях той же
+ * структуры. Для каждого размера выводятся степень сжатия, время сжатия и
+ * распаковки на сообщение и скорость канала, ниже которой сжатие окупается:
+ * сэкономленные байты передаются дольше, чем тратится на сжатие и распаковку.
+ */
+
+using namespace std;
+
+static volatile size_t result_sink = 0; /* результат замера, чтобы компилятор не удалил вычисления */
+
+/* сообщение с котировками примерно заданного размера */
+static std::string make_message(const size_t size, const size_t seed) {
+    std::string message("{\"ticks\":[");
+    for (size_t i = 0; message.size() + 2 < size; ++i) {
+        if (i != 0) message += ',';
+        const size_t value = (seed * 7919 + i * 104729) % 100000;
+        message += "{\"symbol\":\"EURUSD\",\"bid\":1.";
+        message += std::to_string(10000 + value);
+        message += ",\"ask\":1.";
+        message += std::to_string(10002 + value);
+        message += ",\"time\":";
+        message += std::to_string(1600000000 + seed * 1000 + i);
+        message += '}';
+    }
+    message += "]}";
+    return message;
+}
+
+struct Measure {
+    double wall_ns = 0;     /* время на сообщение */
+    double cpu_ns = 0;      /* время процессора на сообщение */
+};
+
+template<class F>
+static Measure measure(const size_t iterations, F function) {
+    size_t sink = 0;
+    const std::clock_t cpu_start = std::clock();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) sink += function(i);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    result_sink = sink;
+    Measure result;
+    result.wall_ns = seconds / iterations * 1e9;
+    result.cpu_ns = cpu_seconds / iterations * 1e9;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t total_bytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (size_t(1) << 28);
+    const size_t sizes[] = {64, 256, 1024, 4096, 65536};
+
+    std::vector<std::string> samples;
+    for (size_t i = 0; i < 256; ++i) samples.push_back(make_message(512, 1000 + i));
+    const SimpleNamedPipe::CompressionDictionary dictionary =
+        SimpleNamedPipe::CompressionDictionary::train(samples);
+    std::cout << "dictionary: " << dictionary.size() << " bytes" << std::endl;
+
+    for (const size_t size : sizes) {
+        // разные сообщения, чтобы не замерять сжатие одного и того же
+        std::vector<std::string> messages;
+        for (size_t i = 0; i < 64; ++i) messages.push_back(make_message(size, i));
+        std::vector<std::string> frames(messages.size());
+        size_t original_bytes = 0;
+        size_t frame_bytes = 0;
+        for (size_t i = 0; i < messages.size(); ++i) {
+            if (!SimpleNamedPipe::make_compressed_frame(messages[i].data(), messages[i].size(), dictionary, frames[i])) {
+                frames[i] = messages[i];
+            }
+            original_bytes += messages[i].size();
+            frame_bytes += frames[i].size();
+        }
+
+        const size_t iterations = std::max<size_t>(1000, total_bytes / size);
+        std::string frame;
+        const Measure compress = measure(iterations, [&](size_t i) {
+            const std::string &message = messages[i % messages.size()];
+            SimpleNamedPipe::make_compressed_frame(message.data(), message.size(), dictionary, frame);
+            return frame.size();
+        });
+        std::string message;
+        const Measure decompress = measure(iterations, [&](size_t i) {
+            const std::string &data = frames[i % frames.size()];
+            SimpleNamedPipe::FrameHeader header;
+            if (!SimpleNamedPipe::parse_frame(data.data(), data.size(), header) ||
+                header.kind != SimpleNamedPipe::FRAME_COMPRESSED) return data.size();
+            SimpleNamedPipe::read_compressed_frame(header, data.data(), dictionary, message);
+            return message.size();
+        });
+
+        const double average_size = static_cast<double>(original_bytes) / messages.size();
+        const double saved_bytes = static_cast<double>(original_bytes - frame_bytes) / messages.size();
+        const double cpu_ns = compress.cpu_ns + decompress.cpu_ns;
+        std::cout << "size " << size
+            << ": ratio " << static_cast<double>(original_bytes) / frame_bytes
+            << ", compress " << compress.wall_ns << " ns/msg (cpu " << compress.cpu_ns << " ns, "
+            << average_size / compress.wall_ns * 1e3 << " MB/s)"
+            << ", decompress " << decompress.wall_ns << " ns/msg (cpu " << decompress.cpu_ns << " ns, "
+            << average_size / decompress.wall_ns * 1e3 << " MB/s)"
+            << ", pays off below " << (cpu_ns > 0 ? saved_bytes / cpu_ns * 1e3 : 0.0) << " MB/s link"
+            << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include "named-pipe-crc32c.hpp"
+
+/* Стоимость контрольной суммы CRC32C по размерам сообщений:
+ * таблицы slicing-by-8, инструкции SSE4.2 и полный цикл кадра
+ * FRAME_CHECKED (сборка на отправителе и проверка на получателе).
+ */
+
+using namespace std;
+
+static volatile uint32_t result_sink = 0; /* результат замера, чтобы компилятор не удалил вычисления */
+
+template<class F>
+static void measure(const char *title, const size_t size, F function) {
+    // около 256 МБ данных на каждый замер
+    const size_t iterations = std::max<size_t>(1000, (size_t(1) << 28) / size);
+    uint32_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) sink += function(i);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << title << " size " << size
+        << ": " << seconds / iterations * 1e9 << " ns/msg, "
+        << iterations * size / seconds / 1e9 << " GB/s" << std::endl;
+    result_sink = sink;
+}
+
+int main() {
+    const size_t sizes[] = {16, 64, 256, 1024, 4096, 65536};
+#   ifdef SIMPLE_NAMED_PIPE_CRC32C_SSE42
+    const bool is_sse42 = SimpleNamedPipe::has_sse42();
+#   else
+    const bool is_sse42 = false;
+#   endif
+    std::cout << "SSE4.2: " << (is_sse42 ? "yes" : "no") << std::endl;
+
+    for (const size_t size : sizes) {
+        std::string message(size, 'x');
+        for (size_t i = 0; i < size; ++i) message[i] = static_cast<char>(i * 31);
+
+        measure("software", size, [&](size_t i) {
+            message[0] = static_cast<char>(i);
+            return SimpleNamedPipe::crc32c_software(0, message.data(), size);
+        });
+#       ifdef SIMPLE_NAMED_PIPE_CRC32C_SSE42
+        if (is_sse42) {
+            measure("hardware", size, [&](size_t i) {
+                message[0] = static_cast<char>(i);
+                return SimpleNamedPipe::crc32c_hardware(0, message.data(), size);
+            });
+        }
+#       endif
+        std::string frame;
+        measure("frame   ", size, [&](size_t i) {
+            message[0] = static_cast<char>(i);
+            SimpleNamedPipe::make_checked_frame(message.data(), size, frame);
+            SimpleNamedPipe::FrameHeader header;
+            if (!SimpleNamedPipe::parse_frame(frame.data(), frame.size(), header)) return 0u;
+            return SimpleNamedPipe::check_frame(header, frame.data()) ? 1u : 0u;
+        });
+    }
+    return EXIT_SUCCESS;
+}
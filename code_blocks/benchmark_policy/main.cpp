@@ -0,0 +1,191 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+
+/* Стоимость одного сообщения с политиками ThreadedLock и SingleThreadedLock.
+ *
+ * Сначала замеряются сами примитивы политик: захват мьютекса, атомарный
+ * флаг и счетчик статистики. Затем NamedPipeServer и
+ * SingleThreadedNamedPipeServer в режиме опроса принимают сообщения
+ * клиента (poll_once) и рассылают сообщения send_all() + flush().
+ * Клиент - простой хендлер канала в отдельном потоке.
+ *
+ * Запуск: benchmark_policy [сообщений] [размер сообщения]
+ */
+
+using namespace std;
+
+static volatile size_t result_sink = 0; /* результат замера, чтобы компилятор не удалил вычисления */
+
+template<class F>
+static double measure_ns(const size_t iterations, F function) {
+    size_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) sink += function(i);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result_sink = sink;
+    return seconds / iterations * 1e9;
+}
+
+/* мьютекс, флаг и счетчик на каждое сообщение, как в пути чтения сервера */
+template<class LockPolicy, class StatsPolicy>
+static void measure_primitives(const char *title, const size_t iterations) {
+    typename LockPolicy::mutex_type mutex;
+    typename LockPolicy::template atomic_type<bool> flag(false);
+    typename StatsPolicy::template counter_type<uint64_t> counter(0);
+    const double lock_ns = measure_ns(iterations, [&](size_t) {
+        std::lock_guard<typename LockPolicy::mutex_type> locker(mutex);
+        return size_t(1);
+    });
+    const double flag_ns = measure_ns(iterations, [&](size_t i) {
+        flag = (i & 1) != 0;
+        return flag ? size_t(1) : size_t(0);
+    });
+    const double counter_ns = measure_ns(iterations, [&](size_t) {
+        ++counter;
+        return size_t(1);
+    });
+    std::cout << title << ": lock " << lock_ns << " ns, flag " << flag_ns
+        << " ns, counter " << counter_ns << " ns" << std::endl;
+}
+
+static HANDLE open_pipe(const std::string &pipename) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        const HANDLE pipe = CreateFileA(
+            pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            SetNamedPipeHandleState(pipe, &mode, NULL, NULL);
+            return pipe;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY && GetLastError() != ERROR_FILE_NOT_FOUND) break;
+        WaitNamedPipeA(pipename.c_str(), 100);
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+/* один цикл опроса сервера с ожиданием его хендлеров */
+template<class Server>
+static void poll_server(Server &server, std::vector<HANDLE> &handles) {
+    server.get_wait_handles(handles);
+    const DWORD count = static_cast<DWORD>(std::min<size_t>(handles.size(), MAXIMUM_WAIT_OBJECTS));
+    WaitForMultipleObjects(count, handles.data(), FALSE, std::min<DWORD>(server.get_poll_timeout(), 10));
+    server.poll_once();
+}
+
+template<class Server>
+static void measure_server(const char *title, const size_t count, const size_t size) {
+    const std::string name(std::string("benchmark_policy_") + title);
+    const std::string pipename("\\\\.\\pipe\\" + name);
+    const std::string message(size, 'x');
+
+    Server server(name, std::max<size_t>(size, 2048));
+    size_t received = 0;
+    bool is_open = false;
+    server.on_open = [&](typename Server::Connection*) {
+        is_open = true;
+    };
+    server.on_message = [&](typename Server::Connection*, const std::string &) {
+        ++received;
+    };
+    server.on_close = [](typename Server::Connection*) {};
+    server.on_error = [](typename Server::Connection*, const std::error_code &) {};
+    if (!server.start_poll()) {
+        std::cout << title << ": start_poll failed" << std::endl;
+        return;
+    }
+
+    std::vector<HANDLE> handles;
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    std::thread connector([&]() {
+        pipe = open_pipe(pipename);
+    });
+    while (!is_open) poll_server(server, handles);
+    connector.join();
+    if (pipe == INVALID_HANDLE_VALUE) {
+        std::cout << title << ": connect failed" << std::endl;
+        server.stop();
+        return;
+    }
+
+    // прием: клиент пишет, сервер читает в poll_once()
+    const auto read_start = std::chrono::steady_clock::now();
+    std::thread writer([&]() {
+        for (size_t i = 0; i < count; ++i) {
+            DWORD bytes = 0;
+            if (!WriteFile(pipe, message.data(), static_cast<DWORD>(size), &bytes, NULL)) break;
+        }
+    });
+    while (received < count) poll_server(server, handles);
+    const double read_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - read_start).count();
+    writer.join();
+
+    // рассылка: сервер пишет send_all() + flush(), клиент читает
+    size_t delivered = 0;
+    const auto write_start = std::chrono::steady_clock::now();
+    std::thread reader([&]() {
+        std::vector<char> buffer(size + 64);
+        while (delivered < count) {
+            DWORD bytes = 0;
+            if (!ReadFile(pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, NULL)) break;
+            ++delivered;
+        }
+    });
+    for (size_t i = 0; i < count; ++i) {
+        server.send_all(message);
+        // пачками, чтобы очередь рассылки не росла без ограничения
+        if ((i & 63) == 63) server.flush();
+    }
+    server.flush();
+    reader.join();
+    const double write_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+
+    CloseHandle(pipe);
+    server.stop();
+    std::cout << title << " size " << size
+        << ": receive " << read_seconds / count * 1e9 << " ns/msg"
+        << ", broadcast " << write_seconds / count * 1e9 << " ns/msg"
+        << ", delivered " << delivered << " of " << count << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    const size_t size = argc > 2 ? std::stoul(argv[2]) : 64;
+
+    const size_t iterations = 100000000;
+    measure_primitives<SimpleNamedPipe::ThreadedLock, SimpleNamedPipe::AtomicStats>("ThreadedLock + AtomicStats", iterations);
+    measure_primitives<SimpleNamedPipe::SingleThreadedLock, SimpleNamedPipe::PlainStats>("SingleThreadedLock + PlainStats", iterations);
+
+    measure_server<SimpleNamedPipe::NamedPipeServer>("threaded", count, size);
+    measure_server<SimpleNamedPipe::SingleThreadedNamedPipeServer>("single", count, size);
+    return EXIT_SUCCESS;
+}
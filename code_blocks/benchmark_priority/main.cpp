@@ -0,0 +1,169 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+
+/* Задержка управляющих сообщений, когда очередь рассылки забита объемными.
+ *
+ * Поток нагрузки держит в очереди сервера заданное число обычных сообщений,
+ * а раз в миллисекунду отправляется короткое сообщение с меткой времени:
+ * сначала с Priority::NORMAL, затем с Priority::HIGH. Клиент - простой
+ * хендлер канала - считает задержку от send_all() до чтения.
+ *
+ * Запуск: benchmark_priority [размер обычного сообщения] [сообщений в очереди] [секунд на замер]
+ */
+
+using namespace std;
+
+using Server = SimpleNamedPipe::NamedPipeServer;
+
+static uint64_t get_time_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static HANDLE open_pipe(const std::string &pipename) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        const HANDLE pipe = CreateFileA(
+            pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            SetNamedPipeHandleState(pipe, &mode, NULL, NULL);
+            return pipe;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY && GetLastError() != ERROR_FILE_NOT_FOUND) break;
+        WaitNamedPipeA(pipename.c_str(), 100);
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+static void print_latency(const char *title, std::vector<uint64_t> &latency) {
+    if (latency.empty()) {
+        std::cout << title << ": no samples" << std::endl;
+        return;
+    }
+    std::sort(latency.begin(), latency.end());
+    const auto percentile = [&](const double p) {
+        return latency[std::min(latency.size() - 1, static_cast<size_t>(p * latency.size()))] / 1000.0;
+    };
+    std::cout << title << ": samples " << latency.size()
+        << ", p50 " << percentile(0.5) << " us"
+        << ", p99 " << percentile(0.99) << " us"
+        << ", max " << latency.back() / 1000.0 << " us" << std::endl;
+}
+
+/* один замер: нагрузка обычными сообщениями и пробы с заданным приоритетом */
+static void measure(
+        Server &server,
+        const HANDLE pipe,
+        const size_t bulk_size,
+        const size_t backlog,
+        const size_t seconds,
+        const Server::Priority priority,
+        const char *title) {
+    std::atomic<bool> is_running(true);
+    std::atomic<uint64_t> bulk_sent(0);
+    std::atomic<uint64_t> bulk_received(0);
+    std::vector<uint64_t> latency;
+
+    std::thread reader([&]() {
+        std::vector<char> buffer(bulk_size + 64);
+        while (true) {
+            DWORD bytes = 0;
+            if (!ReadFile(pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, NULL) || bytes == 0) break;
+            if (buffer[0] == 'E') break;
+            if (buffer[0] == 'P') {
+                const uint64_t sent = std::strtoull(std::string(buffer.data() + 1, bytes - 1).c_str(), nullptr, 10);
+                latency.push_back(get_time_ns() - sent);
+            } else {
+                ++bulk_received;
+            }
+        }
+    });
+
+    const std::string bulk(bulk_size, 'B');
+    std::thread producer([&]() {
+        while (is_running) {
+            if (bulk_sent - bulk_received >= backlog) {
+                std::this_thread::yield();
+                continue;
+            }
+            server.send_all(bulk);
+            ++bulk_sent;
+        }
+    });
+
+    const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < end) {
+        server.send_all("P" + std::to_string(get_time_ns()), priority);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    is_running = false;
+    producer.join();
+    server.send_all("E", Server::Priority::NORMAL);
+    reader.join();
+    print_latency(title, latency);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t bulk_size = argc > 1 ? std::stoul(argv[1]) : 16 * 1024;
+    const size_t backlog = argc > 2 ? std::stoul(argv[2]) : 256;
+    const size_t seconds = argc > 3 ? std::stoul(argv[3]) : 5;
+
+    const std::string name("benchmark_priority");
+    Server server(name, bulk_size + 64);
+    std::atomic<bool> is_open(false);
+    server.on_open = [&](Server::Connection*) {
+        is_open = true;
+    };
+    server.on_message = [](Server::Connection*, const std::string &) {};
+    server.on_close = [](Server::Connection*) {};
+    server.on_error = [](Server::Connection*, const std::error_code &) {};
+    if (!server.start()) {
+        std::cout << "start failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const HANDLE pipe = open_pipe("\\\\.\\pipe\\" + name);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        std::cout << "connect failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    while (!is_open) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::cout << "bulk " << bulk_size << " bytes, backlog " << backlog << " messages" << std::endl;
+    measure(server, pipe, bulk_size, backlog, seconds, Server::Priority::NORMAL, "NORMAL probe");
+    measure(server, pipe, bulk_size, backlog, seconds, Server::Priority::HIGH, "HIGH probe  ");
+
+    CloseHandle(pipe);
+    server.stop();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+
+/* Задержка stop() и повторного запуска сервера с открытыми соединениями.
+ * Клиенты открываются простыми хендлерами канала, чтобы в процессе
+ * работали только потоки сервера.
+ * Запуск: benchmark_restart [соединений] [циклов]
+ */
+
+using namespace std;
+
+static bool open_clients(const std::string &pipename, const size_t count, std::vector<HANDLE> &clients) {
+    while (clients.size() < count) {
+        const HANDLE pipe = CreateFileA(
+            pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            clients.push_back(pipe);
+            continue;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY && GetLastError() != ERROR_FILE_NOT_FOUND) return false;
+        WaitNamedPipeA(pipename.c_str(), 100);
+    }
+    return true;
+}
+
+static void close_clients(std::vector<HANDLE> &clients) {
+    for (const HANDLE pipe : clients) CloseHandle(pipe);
+    clients.clear();
+}
+
+int main(int argc, char *argv[]) {
+    const size_t connections = argc > 1 ? std::stoul(argv[1]) : 1000;
+    const size_t cycles = std::max<size_t>(1, argc > 2 ? std::stoul(argv[2]) : 20);
+    const std::string name("benchmark_restart");
+    const std::string pipename("\\\\.\\pipe\\" + name);
+
+    SimpleNamedPipe::NamedPipeServer server(name);
+    server.on_open = [](SimpleNamedPipe::NamedPipeServer::Connection*) {};
+    server.on_message = [](SimpleNamedPipe::NamedPipeServer::Connection*, const std::string &) {};
+    server.on_close = [](SimpleNamedPipe::NamedPipeServer::Connection*) {};
+    server.on_error = [](SimpleNamedPipe::NamedPipeServer::Connection*, const std::error_code &) {};
+
+    std::vector<double> stop_us;
+    std::vector<double> start_us;
+    std::vector<HANDLE> clients;
+    for (size_t cycle = 0; cycle < cycles; ++cycle) {
+        const auto start_time = std::chrono::steady_clock::now();
+        if (!server.start()) {
+            std::cout << "start failed" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // время до первого подключения - время готовности сервера после перезапуска
+        if (!open_clients(pipename, 1, clients)) {
+            std::cout << "connect failed, GLE=" << GetLastError() << std::endl;
+            return EXIT_FAILURE;
+        }
+        start_us.push_back(std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start_time).count());
+
+        if (!open_clients(pipename, connections, clients)) {
+            std::cout << "connect failed, GLE=" << GetLastError() << std::endl;
+            return EXIT_FAILURE;
+        }
+        while (server.get_connections() < connections) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        const auto stop_time = std::chrono::steady_clock::now();
+        server.stop();
+        stop_us.push_back(std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - stop_time).count());
+        close_clients(clients);
+    }
+
+    auto print = [](const char *title, std::vector<double> &values) {
+        std::sort(values.begin(), values.end());
+        double sum = 0;
+        for (const double value : values) sum += value;
+        std::cout << title
+            << " min " << values.front() << " us"
+            << ", median " << values[values.size() / 2] << " us"
+            << ", mean " << sum / values.size() << " us"
+            << ", max " << values.back() << " us" << std::endl;
+    };
+    std::cout << "connections " << connections << ", cycles " << cycles << std::endl;
+    print("stop()         ", stop_us);
+    print("start() to open", start_us);
+    return EXIT_SUCCESS;
+}
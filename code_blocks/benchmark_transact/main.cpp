@@ -0,0 +1,179 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+#include "named-pipe-client.hpp"
+
+/* Запрос-ответ: синхронный transact() против асинхронного клиента.
+ *
+ * Сервер отвечает эхом. Для каждого способа замеряется задержка одного
+ * запроса (следующий отправляется после ответа на предыдущий), а для
+ * асинхронного клиента еще и пропускная способность, когда в канале
+ * одновременно находится окно из нескольких запросов.
+ *
+ * Запуск: benchmark_transact [запросов] [размер запроса] [окно]
+ */
+
+using namespace std;
+
+using Server = SimpleNamedPipe::NamedPipeServer;
+using Client = SimpleNamedPipe::NamedPipeClient;
+
+static void print_latency(const char *title, std::vector<uint64_t> &latency, const double seconds) {
+    if (latency.empty()) {
+        std::cout << title << ": no replies" << std::endl;
+        return;
+    }
+    std::sort(latency.begin(), latency.end());
+    const auto percentile = [&](const double p) {
+        return latency[std::min(latency.size() - 1, static_cast<size_t>(p * latency.size()))] / 1000.0;
+    };
+    std::cout << title << ": " << latency.size() / seconds << " req/s"
+        << ", p50 " << percentile(0.5) << " us"
+        << ", p99 " << percentile(0.99) << " us"
+        << ", max " << latency.back() / 1000.0 << " us" << std::endl;
+}
+
+static uint64_t elapsed_ns(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static void measure_transact(const std::string &name, const std::string &request, const size_t count) {
+    Client client(name);
+    client.on_error = [](const std::error_code &) {};
+    std::string reply;
+    // первый запрос открывает канал
+    if (!client.transact(request, reply, 5000)) {
+        std::cout << "transact: connect failed" << std::endl;
+        return;
+    }
+    std::vector<uint64_t> latency;
+    latency.reserve(count);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        const auto request_start = std::chrono::steady_clock::now();
+        if (!client.transact(request, reply, 5000)) break;
+        latency.push_back(elapsed_ns(request_start));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    client.stop();
+    print_latency("transact     ", latency, seconds);
+}
+
+/* асинхронный клиент, в канале одновременно не больше window запросов */
+static void measure_async(const std::string &name, const std::string &request, const size_t count, const size_t window) {
+    Client client(name);
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool is_open = false;
+    size_t replies = 0;
+    client.on_open = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_open = true;
+        condition.notify_one();
+    };
+    client.on_message = [&](const std::string &) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++replies;
+        condition.notify_one();
+    };
+    client.on_close = []() {};
+    client.on_error = [](const std::error_code &) {};
+    if (!client.start()) {
+        std::cout << "async: start failed" << std::endl;
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!condition.wait_for(lock, std::chrono::seconds(5), [&]() { return is_open; })) {
+            std::cout << "async: connect failed" << std::endl;
+            client.stop();
+            return;
+        }
+    }
+
+    // ответы приходят по порядку, поэтому время отправки каждого запроса хранится по номеру
+    std::vector<std::chrono::steady_clock::time_point> sent(count);
+    std::vector<uint64_t> latency;
+    latency.reserve(count);
+    size_t next = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (latency.size() < count) {
+        while (next < count && next - latency.size() < window) {
+            sent[next++] = std::chrono::steady_clock::now();
+            lock.unlock();
+            client.send(request);
+            lock.lock();
+        }
+        if (!condition.wait_for(lock, std::chrono::seconds(5), [&]() { return replies > latency.size(); })) break;
+        const auto now = std::chrono::steady_clock::now();
+        while (latency.size() < replies) {
+            latency.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[latency.size()]).count());
+        }
+    }
+    lock.unlock();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    client.stop();
+    const std::string title = "async window " + std::to_string(window);
+    print_latency(title.c_str(), latency, seconds);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    const size_t size = argc > 2 ? std::stoul(argv[2]) : 64;
+    const size_t window = argc > 3 ? std::stoul(argv[3]) : 32;
+
+    const std::string name("benchmark_transact");
+    Server server(name, std::max<size_t>(size, 2048));
+    server.on_open = [](Server::Connection*) {};
+    server.on_message = [](Server::Connection *connection, const std::string &in_message) {
+        connection->send(in_message);
+    };
+    server.on_close = [](Server::Connection*) {};
+    server.on_error = [](Server::Connection*, const std::error_code &) {};
+    if (!server.start()) {
+        std::cout << "start failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string request(size, 'q');
+    std::cout << "requests " << count << ", size " << size << " bytes" << std::endl;
+    measure_transact(name, request, count);
+    measure_async(name, request, count, 1);
+    if (window > 1) measure_async(name, request, count, window);
+
+    server.stop();
+    return EXIT_SUCCESS;
+}
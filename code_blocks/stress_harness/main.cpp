@@ -0,0 +1,332 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "named-pipe-server.hpp"
+#include <psapi.h>
+#include <tlhelp32.h>
+
+/* Нагрузочный стенд сервера.
+ *
+ * churn - рабочие потоки пачками открывают соединения, пишут в каждое
+ * сообщение и закрывают всю пачку, пока сервер рассылает send_all.
+ * Раз в секунду выводятся соединения и потоки сервера, потоки, RSS и
+ * хендлеры процесса, задержка подключения. После остановки нагрузки
+ * ресурсы должны вернуться к исходному уровню, иначе код возврата 1.
+ *
+ * idle - открывается много соединений без трафика. Прирост RSS на
+ * соединение должен уложиться в предел, а процессорное время процесса
+ * за время простоя - остаться около нуля: потоки соединений спят до
+ * прихода данных. Иначе код возврата 1.
+ *
+ * Запуск: stress_harness churn [потоков] [соединений на поток] [секунд]
+ *         stress_harness idle [соединений] [предел RSS на соединение, КБ] [секунд простоя]
+ */
+
+using namespace std;
+
+using Server = SimpleNamedPipe::NamedPipeServer;
+
+/* Ресурсы процесса */
+class ProcessStats {
+public:
+    size_t threads = 0;
+    size_t rss = 0;     /* рабочий набор, байт */
+    size_t handles = 0;
+    uint64_t cpu_ms = 0; /* процессорное время процесса, пользователь и ядро */
+
+    static ProcessStats get() {
+        ProcessStats stats;
+        const DWORD pid = GetCurrentProcessId();
+        const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot != INVALID_HANDLE_VALUE) {
+            THREADENTRY32 entry;
+            entry.dwSize = sizeof(entry);
+            if (Thread32First(snapshot, &entry)) {
+                do {
+                    if (entry.th32OwnerProcessID == pid) ++stats.threads;
+                } while (Thread32Next(snapshot, &entry));
+            }
+            CloseHandle(snapshot);
+        }
+        PROCESS_MEMORY_COUNTERS memory;
+        memory.cb = sizeof(memory);
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) {
+            stats.rss = memory.WorkingSetSize;
+        }
+        DWORD handles = 0;
+        if (GetProcessHandleCount(GetCurrentProcess(), &handles)) stats.handles = handles;
+        FILETIME creation_time, exit_time, kernel_time, user_time;
+        if (GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+            // FILETIME считает интервалы по 100 нс
+            const uint64_t kernel = (uint64_t(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+            const uint64_t user = (uint64_t(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+            stats.cpu_ms = (kernel + user) / 10000;
+        }
+        return stats;
+    }
+};
+
+/* Счетчики клиентов за интервал вывода */
+class ClientCounters {
+public:
+    std::atomic<uint64_t> connected;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> connect_us;       /* суммарное время подключения */
+    std::atomic<uint64_t> max_connect_us;
+
+    ClientCounters() : connected(0), failed(0), connect_us(0), max_connect_us(0) {}
+
+    void add(const uint64_t us) {
+        ++connected;
+        connect_us += us;
+        uint64_t max_us = max_connect_us;
+        while (us > max_us && !max_connect_us.compare_exchange_weak(max_us, us)) {}
+    }
+};
+
+static HANDLE open_pipe(const std::string &pipename) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        const HANDLE pipe = CreateFileA(
+            pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+            OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE) return pipe;
+        if (GetLastError() != ERROR_PIPE_BUSY) return INVALID_HANDLE_VALUE;
+        WaitNamedPipeA(pipename.c_str(), 100);
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+static void run_churn_worker(
+        const std::string &pipename,
+        const size_t batch,
+        const std::atomic<bool> &is_running,
+        ClientCounters &counters) {
+    const std::string message("{\"stress\":1}");
+    std::vector<HANDLE> pipes;
+    while (is_running) {
+        for (size_t i = 0; i < batch && is_running; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            const HANDLE pipe = open_pipe(pipename);
+            if (pipe == INVALID_HANDLE_VALUE) {
+                ++counters.failed;
+                continue;
+            }
+            counters.add(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            DWORD bytes_written = 0;
+            WriteFile(pipe, message.data(), static_cast<DWORD>(message.size()), &bytes_written, NULL);
+            pipes.push_back(pipe);
+        }
+        for (const HANDLE pipe : pipes) CloseHandle(pipe);
+        pipes.clear();
+    }
+}
+
+static void print_header() {
+    std::cout << "time,s  conn  srv_thr  proc_thr  rss,MB  handles  accept_us  max_accept_us  connects  fails  avg_conn_us  max_conn_us" << std::endl;
+}
+
+static void print_sample(const double seconds, Server &server, ClientCounters *counters) {
+    const Server::Stats stats = server.get_stats();
+    const ProcessStats process = ProcessStats::get();
+    std::cout << seconds
+        << "  " << stats.connections
+        << "  " << stats.threads
+        << "  " << process.threads
+        << "  " << process.rss / (1024.0 * 1024.0)
+        << "  " << process.handles
+        << "  " << stats.accept_latency_us
+        << "  " << stats.max_accept_latency_us;
+    if (counters) {
+        const uint64_t connected = counters->connected.exchange(0);
+        const uint64_t connect_us = counters->connect_us.exchange(0);
+        std::cout
+            << "  " << connected
+            << "  " << counters->failed.exchange(0)
+            << "  " << (connected ? connect_us / connected : 0)
+            << "  " << counters->max_connect_us.exchange(0);
+    }
+    std::cout << std::endl;
+}
+
+static int run_churn(const size_t workers, const size_t batch, const size_t duration) {
+    const std::string name("stress_harness");
+    const std::string pipename("\\\\.\\pipe\\" + name);
+
+    Server server(name);
+    std::atomic<uint64_t> messages(0);
+    server.on_open = [](Server::Connection*) {};
+    server.on_message = [&](Server::Connection*, const std::string &) {
+        ++messages;
+    };
+    server.on_close = [](Server::Connection*) {};
+    server.on_error = [](Server::Connection*, const std::error_code &) {};
+    if (!server.start()) {
+        std::cout << "start failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    const ProcessStats baseline = ProcessStats::get();
+    std::cout << "baseline: threads " << baseline.threads
+        << ", rss " << baseline.rss / (1024.0 * 1024.0) << " MB"
+        << ", handles " << baseline.handles << std::endl;
+
+    std::atomic<bool> is_running(true);
+    ClientCounters counters;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back(run_churn_worker, std::cref(pipename), batch, std::cref(is_running), std::ref(counters));
+    }
+    threads.emplace_back([&]() {
+        while (is_running) {
+            server.send_all("{\"broadcast\":1}");
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    print_header();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t second = 1; second <= duration; ++second) {
+        std::this_thread::sleep_until(start + std::chrono::seconds(second));
+        print_sample(static_cast<double>(second), server, &counters);
+    }
+    is_running = false;
+    for (auto &thread : threads) thread.join();
+    std::cout << "churn stopped, messages received " << messages << std::endl;
+
+    // закрытые соединения удаляются не реже clear_period, даем запас
+    const size_t thread_slack = 2;
+    const size_t handle_slack = 32;
+    const size_t rss_slack = 16 * 1024 * 1024;
+    bool is_recovered = false;
+    const auto stop_time = std::chrono::steady_clock::now();
+    for (int i = 1; i <= 10 && !is_recovered; ++i) {
+        std::this_thread::sleep_until(stop_time + std::chrono::milliseconds(500 * i));
+        print_sample(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), server, nullptr);
+        const Server::Stats stats = server.get_stats();
+        const ProcessStats process = ProcessStats::get();
+        is_recovered = stats.connections == 0 && stats.threads == 0 &&
+            process.threads <= baseline.threads + thread_slack &&
+            process.handles <= baseline.handles + handle_slack &&
+            process.rss <= baseline.rss + rss_slack;
+    }
+    server.stop();
+    std::cout << (is_recovered ? "PASS" : "FAIL: resources did not return to baseline") << std::endl;
+    return is_recovered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int run_idle(const size_t count, const size_t rss_limit_kb, const size_t idle_seconds) {
+    const std::string name("stress_harness_idle");
+    const std::string pipename("\\\\.\\pipe\\" + name);
+
+    Server server(name);
+    std::atomic<uint64_t> messages(0);
+    server.on_open = [](Server::Connection*) {};
+    server.on_message = [&](Server::Connection*, const std::string &) {
+        ++messages;
+    };
+    server.on_close = [](Server::Connection*) {};
+    server.on_error = [](Server::Connection*, const std::error_code &) {};
+    if (!server.start()) {
+        std::cout << "start failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    const ProcessStats baseline = ProcessStats::get();
+    std::cout << "baseline: threads " << baseline.threads
+        << ", rss " << baseline.rss / (1024.0 * 1024.0) << " MB"
+        << ", handles " << baseline.handles << std::endl;
+
+    // клиентские хендлеры этого же процесса не занимают рабочий набор
+    std::vector<HANDLE> pipes;
+    pipes.reserve(count);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        const HANDLE pipe = open_pipe(pipename);
+        if (pipe == INVALID_HANDLE_VALUE) break;
+        pipes.push_back(pipe);
+    }
+    std::cout << "opened " << pipes.size() << " of " << count << " connections in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    for (int i = 0; i < 300 && server.get_stats().connections < pipes.size(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    print_header();
+    print_sample(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), server, nullptr);
+
+    // простой: соединения открыты, данных нет
+    const ProcessStats before = ProcessStats::get();
+    std::this_thread::sleep_for(std::chrono::seconds(idle_seconds));
+    const ProcessStats after = ProcessStats::get();
+    print_sample(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), server, nullptr);
+
+    const size_t connections = server.get_stats().connections;
+    const double rss_per_connection = connections == 0 ? 0.0 :
+        (after.rss > baseline.rss ? after.rss - baseline.rss : 0) / 1024.0 / connections;
+    const uint64_t idle_cpu_ms = after.cpu_ms - before.cpu_ms;
+    // опрос канала раз в 1 мс на каждом соединении занял бы ядра целиком
+    const uint64_t cpu_limit_ms = 10 * idle_seconds;
+    std::cout << "connections " << connections
+        << ", rss per connection " << rss_per_connection << " KB (limit " << rss_limit_kb << " KB)"
+        << ", threads per connection " << (connections == 0 ? 0.0 :
+            static_cast<double>(after.threads - baseline.threads) / connections)
+        << ", handles per connection " << (connections == 0 ? 0.0 :
+            static_cast<double>(after.handles - baseline.handles) / connections)
+        << ", idle cpu " << idle_cpu_ms << " ms over " << idle_seconds << " s (limit " << cpu_limit_ms << " ms)"
+        << std::endl;
+
+    for (const HANDLE pipe : pipes) CloseHandle(pipe);
+    server.stop();
+
+    const bool is_passed = connections == count &&
+        rss_per_connection <= static_cast<double>(rss_limit_kb) &&
+        idle_cpu_ms <= cpu_limit_ms;
+    std::cout << (is_passed ? "PASS" : "FAIL: idle connections exceed the budget") << std::endl;
+    return is_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) {
+    const std::string mode = argc > 1 ? argv[1] : "churn";
+    if (mode == "churn") {
+        const size_t workers = argc > 2 ? std::stoul(argv[2]) : 32;
+        const size_t batch = argc > 3 ? std::stoul(argv[3]) : 64;
+        const size_t duration = argc > 4 ? std::stoul(argv[4]) : 30;
+        return run_churn(workers, batch, duration);
+    }
+    if (mode == "idle") {
+        const size_t count = argc > 2 ? std::stoul(argv[2]) : 10000;
+        const size_t rss_limit_kb = argc > 3 ? std::stoul(argv[3]) : 32;
+        const size_t idle_seconds = argc > 4 ? std::stoul(argv[4]) : 10;
+        return run_idle(count, rss_limit_kb, idle_seconds);
+    }
+    std::cout << "usage: stress_harness churn [threads] [connections per thread] [seconds]" << std::endl;
+    std::cout << "       stress_harness idle [connections] [rss limit per connection, KB] [idle seconds]" << std::endl;
+    return EXIT_FAILURE;
+}
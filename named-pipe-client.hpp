@@ -24,30 +24,347 @@
 #ifndef SIMPLE_NAMED_PIPE_CLIENT_HPP_INCLUDED
 #define SIMPLE_NAMED_PIPE_CLIENT_HPP_INCLUDED
 
-#include <iostream>
 #include <windows.h>
 #include <mutex>
 #include <atomic>
 #include <future>
 #include <system_error>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <functional>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include "named-pipe-compress.hpp"
+#include "named-pipe-crc32c.hpp"
+#include "named-pipe-delta.hpp"
+#include "named-pipe-frame.hpp"
+#include "named-pipe-inproc.hpp"
+#include "named-pipe-memory.hpp"
+#include "named-pipe-policy.hpp"
+#include "named-pipe-trace.hpp"
 
 namespace SimpleNamedPipe {
 
     /** \brief Класс клиента именованных каналов
+     *
+     * Параметры шаблона задают политики клиента (см. named-pipe-policy.hpp).
+     * \tparam LockPolicy      Блокировки и атомарные флаги: ThreadedLock или SingleThreadedLock
+     * \tparam WaitPolicy      Ожидание данных: EventWait или SpinWait
+     * \tparam AllocatorPolicy Источник памяти по умолчанию: DefaultAllocator или PoolAllocator
      */
-    class NamedPipeClient {
+    template<
+        class LockPolicy = ThreadedLock,
+        class WaitPolicy = EventWait,
+        class AllocatorPolicy = DefaultAllocator>
+    class BasicNamedPipeClient {
+    private:
+        using mutex_t = typename LockPolicy::mutex_type;
+        template<class T> using atomic_t = typename LockPolicy::template atomic_type<T>;
+
+    public:
+
+        /** \brief Приоритет исходящего сообщения
+         */
+        enum class Priority {
+            NORMAL, /**< Обычные и объемные данные */
+            HIGH,   /**< Управляющие сообщения, отправляются раньше обычных */
+        };
+
     private:
         HANDLE pipe = INVALID_HANDLE_VALUE;
-        std::mutex pipe_mutex;
+        mutex_t pipe_mutex;
 
         std::future<void> named_pipe_future;    /**< Поток для обработки сообщений */
-        std::atomic<bool> is_reset;             /**< Команда завершения работы */
-        std::atomic<bool> is_connect;
+        atomic_t<bool> is_reset;                /**< Команда завершения работы */
+        atomic_t<bool> is_connect;
+        HANDLE stop_event = NULL;               /**< Событие остановки, прерывает ожидание переподключения */
+
+        HANDLE transact_pipe = INVALID_HANDLE_VALUE;    /**< Канал синхронного режима transact() */
+        HANDLE transact_event = NULL;                   /**< Событие завершения операций transact() */
+        mutex_t transact_mutex;
+
+        bool is_inproc = false;                 /**< Подключение к серверу этого же процесса */
+        std::shared_ptr<InprocPipe> inproc;     /**< Канал внутри процесса, защищен pipe_mutex */
+        const size_t max_inproc_spins = 1000;   /**< Опросов пустой очереди без ожидания после сообщения */
+
+        /** \brief Записать сообщение в канал внутри процесса
+         *
+         * Очереди приоритетов и каналов не используются: запись в очередь
+         * сервера не ждет системных вызовов, поэтому сообщения уходят сразу.
+         * \param message Сообщение, перемещается в очередь сервера
+         * \return Вернет true в случае успеха
+         */
+        bool write_inproc(std::string &&message) {
+            std::lock_guard<mutex_t> lock(pipe_mutex);
+            if (!inproc) return false;
+            return InprocPipe::push(inproc->to_server, std::move(message), inproc->is_server_closed);
+        }
+
+        /** \brief Обслуживать подключение к серверу этого же процесса
+         * \param name Имя сервера без префикса
+         */
+        void run_inproc(const std::string &name) {
+            while(!is_reset) {
+                std::shared_ptr<InprocPipe> connection = InprocRegistry::connect(name);
+                if(!connection) {
+                    WaitForSingleObject(stop_event, 10);
+                    continue;
+                }
+                {
+                    std::lock_guard<mutex_t> lock(pipe_mutex);
+                    inproc = connection;
+                }
+                is_connect = true;
+                on_open();
+
+                auto last_heartbeat = std::chrono::steady_clock::now();
+                size_t spins = 0;
+                while(!is_reset && is_connect) {
+                    if(config.heartbeat_interval != 0) {
+                        const auto now = std::chrono::steady_clock::now();
+                        if((now - last_heartbeat) >= std::chrono::milliseconds(config.heartbeat_interval)) {
+                            /* поток клиента не ждет места в очереди: заполненная очередь
+                               сервера уже означает активность, а ожидание могло бы
+                               заблокировать чтение ответов сервера */
+                            std::string heartbeat(config.heartbeat_message);
+                            std::lock_guard<mutex_t> lock(pipe_mutex);
+                            connection->to_server.push(std::move(heartbeat));
+                            last_heartbeat = now;
+                        }
+                    }
+
+                    std::string *front = connection->to_client.front();
+                    if(front == nullptr) {
+                        if(connection->is_server_closed) break;
+                        if(spins < max_inproc_spins) {
+                            ++spins;
+                            std::this_thread::yield();
+                        } else {
+                            WaitPolicy::wait(stop_event, 1);
+                        }
+                        continue;
+                    }
+                    spins = 0;
+                    const std::string message(std::move(*front));
+                    connection->to_client.pop();
 
-        std::queue<std::string> queue_messages;
-        std::mutex queue_messages_mutex;
+                    /* heartbeat сервера не передаем в on_message */
+                    if(is_heartbeat(message.data(), message.size())) continue;
+                    SIMPLE_NAMED_PIPE_TRACE_ID(trace_id, Trace::get_message_id(TRACE_FLOW_READ));
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_READ, trace_id);
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_BEGIN, trace_id);
+                    if (!dispatch_channel(message.data(), message.size()) &&
+                        !dispatch_chunk(message.data(), message.size()) &&
+                        !dispatch_typed(message.data(), message.size())) {
+                        on_message(message);
+                    }
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_END, trace_id);
+                }
+                is_connect = false;
+                {
+                    std::lock_guard<mutex_t> lock(pipe_mutex);
+                    connection->is_client_closed = true;
+                    inproc.reset();
+                }
+                close_channels();
+                on_close();
+                break;
+            }
+        }
+
+        MemoryResource *memory_resource = AllocatorPolicy::get_memory_resource(); /**< Источник памяти для очередей и буфера чтения */
+
+        /** \brief Очередь сообщений с возвратом неотправленного сообщения в начало
+         */
+        class MessageQueue : public BufferQueue {
+        public:
+            using BufferQueue::BufferQueue;
+
+            inline void push_front(BufferString &&str) {
+                this->c.push_front(std::move(str));
+            }
+        };
+
+        /** \brief Очередь, из которой взято последнее сообщение
+         */
+        enum class Lane {
+            HIGH,
+            NORMAL,
+            CHANNEL,
+        };
+
+        MessageQueue queue_messages{ResourceAllocator<BufferString>(memory_resource)};       /**< Очередь обычных сообщений */
+        MessageQueue queue_messages_high{ResourceAllocator<BufferString>(memory_resource)};  /**< Очередь приоритетных сообщений */
+        mutex_t queue_messages_mutex;
+        size_t high_burst = 0;                          /**< Приоритетных сообщений подряд */
+        Lane last_lane = Lane::NORMAL;                  /**< Очередь последнего сообщения pop_message() */
+
+        using ChannelQueues = std::unordered_map<uint32_t, BufferQueue, std::hash<uint32_t>, std::equal_to<uint32_t>,
+            ResourceAllocator<std::pair<const uint32_t, BufferQueue>>>;
+        using ChannelDeque = std::deque<uint32_t, ResourceAllocator<uint32_t>>;
+
+        ChannelQueues channel_queues{ResourceAllocator<BufferString>(memory_resource)};  /**< Очереди логических каналов */
+        ChannelDeque ready_channels{ResourceAllocator<BufferString>(memory_resource)};   /**< Каналы с сообщениями в порядке обхода */
+        bool is_channel_turn = false;                   /**< Следующее обычное сообщение берется из каналов */
+
+        /** \brief Обработчики логического канала
+         */
+        class Channel {
+        public:
+            std::function<void(const std::string &in_message)> on_message;
+            std::function<void()> on_close;
+        };
+
+        std::unordered_map<uint32_t, std::shared_ptr<Channel>> channels;   /**< Открытые логические каналы */
+        mutex_t channels_mutex;
+
+        const size_t max_high_burst = 16;               /**< После стольких приоритетных сообщений подряд отправляется одно обычное */
+
+#       ifdef SIMPLE_NAMED_PIPE_TRACE
+        uint64_t trace_enqueue_seq[2] = {0, 0};         /**< Номера сообщений при постановке в очередь: обычная, приоритетная */
+        uint64_t trace_dequeue_seq[2] = {0, 0};         /**< Номера сообщений при извлечении из очереди */
+        uint64_t trace_write_id = 0;                    /**< Идентификатор трассировки последнего извлеченного сообщения */
+#       endif
+
+        /** \brief Взять следующее сообщение из очередей
+         *
+         * Приоритетная очередь опустошается первой, но после max_high_burst
+         * приоритетных сообщений подряд отправляется одно обычное.
+         * Вызывается под queue_messages_mutex.
+         * \param str Сообщение
+         * \return Вернет true, если сообщение было в очереди
+         */
+        bool pop_message(BufferString &str) {
+            if (!queue_messages_high.empty() &&
+                ((queue_messages.empty() && ready_channels.empty()) || high_burst < max_high_burst)) {
+                str = std::move(queue_messages_high.front());
+                queue_messages_high.pop();
+                ++high_burst;
+                last_lane = Lane::HIGH;
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_write_id, Trace::get_queue_id(TRACE_FLOW_CLIENT_HIGH, ++trace_dequeue_seq[1]));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DEQUEUE, trace_write_id);
+                return true;
+            }
+            // обычные сообщения и каналы чередуются, каналы обходятся по кругу,
+            // поэтому загруженный канал не задерживает остальные
+            if (!ready_channels.empty() && (queue_messages.empty() || is_channel_turn)) {
+                is_channel_turn = false;
+                const uint32_t channel = ready_channels.front();
+                ready_channels.pop_front();
+                auto it = channel_queues.find(channel);
+                str = std::move(it->second.front());
+                it->second.pop();
+                if (it->second.empty()) channel_queues.erase(it);
+                else ready_channels.push_back(channel);
+                high_burst = 0;
+                last_lane = Lane::CHANNEL;
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_write_id, 0);
+                return true;
+            }
+            if (queue_messages.empty()) return false;
+            is_channel_turn = true;
+            str = std::move(queue_messages.front());
+            queue_messages.pop();
+            high_burst = 0;
+            last_lane = Lane::NORMAL;
+            SIMPLE_NAMED_PIPE_TRACE_SET(trace_write_id, Trace::get_queue_id(TRACE_FLOW_CLIENT, ++trace_dequeue_seq[0]));
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DEQUEUE, trace_write_id);
+            return true;
+        }
+
+        /** \brief Проверить, является ли сообщение служебным для текущего соединения
+         *
+         * Кадр согласования и heartbeat каждое соединение отправляет свои.
+         */
+        bool is_control_message(const BufferString &str) const {
+            FrameHeader header;
+            if (parse_frame(str.data(), str.size(), header) && header.kind == FRAME_HELLO) return true;
+            return is_heartbeat(str.data(), str.size());
+        }
+
+        /** \brief Вернуть в начало его очереди сообщение, которое не удалось записать
+         *
+         * Вызывается до on_close, чтобы сообщение ушло после переподключения
+         * или было перенесено move_outbox(). Служебные сообщения не
+         * возвращаются, сообщения логических каналов закрываются вместе с каналами.
+         * \param str Сообщение, взятое последним вызовом pop_message()
+         */
+        void requeue_message(BufferString &&str) {
+            if (last_lane == Lane::CHANNEL || is_control_message(str)) return;
+            std::lock_guard<mutex_t> lock(queue_messages_mutex);
+            // номер трассировки сообщения снова будет выдан при извлечении
+            if (last_lane == Lane::HIGH) {
+                queue_messages_high.push_front(std::move(str));
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_dequeue_seq[1], trace_dequeue_seq[1] - 1);
+            } else {
+                queue_messages.push_front(std::move(str));
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_dequeue_seq[0], trace_dequeue_seq[0] - 1);
+            }
+        }
+
+        /** \brief Скопировать сообщение в память memory_resource
+         */
+        inline BufferString make_message(const char *data, const size_t size) {
+            return BufferString(data, size, ResourceAllocator<char>(memory_resource));
+        }
+
+        /** \brief Поставить сообщение в очередь
+         */
+        inline void push_message(BufferString &&str, const Priority priority) {
+            std::lock_guard<mutex_t> lock(queue_messages_mutex);
+            if (priority == Priority::HIGH) {
+                queue_messages_high.push(std::move(str));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_CLIENT_HIGH, ++trace_enqueue_seq[1]));
+            } else {
+                queue_messages.push(std::move(str));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_CLIENT, ++trace_enqueue_seq[0]));
+            }
+        }
+
+        /** \brief Поставить кадр в очередь логического канала
+         */
+        inline void push_channel_message(const uint32_t channel, BufferString &&str) {
+            std::lock_guard<mutex_t> lock(queue_messages_mutex);
+            auto it = channel_queues.find(channel);
+            if (it == channel_queues.end()) {
+                it = channel_queues.emplace(channel, BufferQueue(ResourceAllocator<BufferString>(memory_resource))).first;
+            }
+            if (it->second.empty()) ready_channels.push_back(channel);
+            it->second.push(std::move(str));
+        }
+
+        /** \brief Отправить кадр логического канала
+         */
+        bool push_channel_frame(const uint32_t channel, const uint16_t flags, const char *data, const size_t size) {
+            if (is_inproc) {
+                return write_inproc(make_channel_frame<std::string>(channel, flags, data, size, std::allocator<char>()));
+            }
+            push_channel_message(channel, make_channel_frame<BufferString>(
+                channel, flags, data, size, ResourceAllocator<char>(memory_resource)));
+            return true;
+        }
+
+        /** \brief Закрыть все логические каналы при разрыве соединения
+         */
+        void close_channels() {
+            std::unordered_map<uint32_t, std::shared_ptr<Channel>> closed;
+            {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                closed.swap(channels);
+            }
+            {
+                std::lock_guard<mutex_t> lock(queue_messages_mutex);
+                channel_queues.clear();
+                ready_channels.clear();
+            }
+            for (auto &it : closed) {
+                if (it.second->on_close) it.second->on_close();
+            }
+        }
 
         /** \brief Класс настроек соединения
          */
@@ -55,24 +372,453 @@ namespace SimpleNamedPipe {
         public:
             std::string name;   /**< Имя */
             size_t buffer_size; /**< Размер буфера для чтения и записи */
+            size_t min_buffer_size;         /**< Наименьший размер буфера чтения */
+            size_t max_buffer_size;         /**< Наибольший размер буфера чтения */
+            size_t heartbeat_interval;      /**< Период heartbeat при отсутствии исходящих сообщений, мс, 0 - отключен */
+            std::string heartbeat_message;  /**< Сообщение heartbeat */
+            size_t reconnect_min_delay;     /**< Начальная пауза между попытками подключения, мс, 0 - без переподключения после разрыва */
+            size_t reconnect_max_delay;     /**< Наибольшая пауза между попытками подключения, мс */
 
-            Config() : name("server"), buffer_size(1024) {
+            Config() :
+                name("server"),
+                buffer_size(1024),
+                min_buffer_size(256),
+                max_buffer_size(64 * 1024),
+                heartbeat_interval(0),
+                reconnect_min_delay(0),
+                reconnect_max_delay(0) {
             };
         } config;
 
+        /** \brief Буфер чтения соединения
+         */
+        class ReadBuffer {
+        public:
+            BufferVector data;      /**< Буфер */
+            BufferSizer sizer;      /**< Гистограмма размеров входящих сообщений */
+            size_t size;            /**< Текущий рекомендуемый размер буфера */
+
+            ReadBuffer(MemoryResource *resource, const Config &config) :
+                    data(ResourceAllocator<char>(resource)),
+                    size(config.buffer_size) {
+                sizer.init(
+                    std::min(config.min_buffer_size, config.buffer_size),
+                    std::max(config.max_buffer_size, config.buffer_size));
+            }
+        };
+
+        bool is_poll = false;                   /**< Клиент работает в режиме опроса без собственного потока */
+        bool is_poll_closed = false;            /**< Соединение режима опроса разорвано */
+        std::string poll_pipename;              /**< Полное имя канала в режиме опроса */
+        std::unique_ptr<ReadBuffer> poll_buffer;/**< Буфер чтения соединения в режиме опроса */
+        std::chrono::steady_clock::time_point poll_last_send;   /**< Время последней записи в режиме опроса */
+        HANDLE io_event = NULL;                 /**< Событие операций чтения и записи в режиме опроса */
+        HANDLE read_event = NULL;               /**< Событие готовности данных для цикла событий */
+        OVERLAPPED read_overlapped;             /**< Чтение нуля байт, ожидающее данные */
+        bool is_read_pending = false;           /**< Чтение нуля байт еще не завершено */
+
+        std::shared_ptr<const CompressionDictionary> compression;   /**< Словарь сжатия, nullptr - сжатие выключено */
+        size_t min_compress_size = 128;         /**< Сообщения короче не сжимаются */
+        bool is_checksum = false;               /**< Запросить контрольную сумму сообщений */
+        bool is_delta = false;                  /**< Запросить разностное кодирование рассылки */
+        atomic_t<uint32_t> features;            /**< Возможности, подтвержденные сервером */
+        atomic_t<uint64_t> checksum_errors;     /**< Входящих сообщений с неверной или отсутствующей контрольной суммой */
+
+        /** \brief Возможности, которые клиент предлагает серверу
+         */
+        inline uint32_t get_requested_features() const noexcept {
+            return (compression ? FEATURE_COMPRESSION : 0) |
+                (is_checksum ? FEATURE_CHECKSUM : 0) |
+                (is_delta ? FEATURE_DELTA : 0);
+        }
+
+        /** \brief Последнее значение ключа рассылки
+         */
+        class DeltaValue {
+        public:
+            std::string value;
+            uint32_t version = 0;   /**< Версия значения, 0 - ждем полное значение */
+        };
+
+        std::unordered_map<std::string, DeltaValue> delta_values;   /**< Значения ключей, используются в потоке чтения */
+
+        /** \brief Начать согласование возможностей после подключения
+         *
+         * Кадр согласования уходит первым среди приоритетных сообщений.
+         * До ответа сервера сообщения отправляются без сжатия.
+         */
+        void push_hello() {
+            features = 0;
+            // новое соединение начинает с полных значений ключей
+            delta_values.clear();
+            const uint32_t requested = get_requested_features();
+            if (requested == 0) return;
+            BufferString frame(HELLO_FRAME_SIZE, '\0', ResourceAllocator<char>(memory_resource));
+            write_hello_frame(requested, compression ? compression->get_id() : 0, &frame[0]);
+            push_message(std::move(frame), Priority::HIGH);
+        }
+
+        /** \brief Результат чтения канала
+         */
+        enum class ReadStatus {
+            EMPTY,      /**< Данных нет */
+            MESSAGE,    /**< Сообщение прочитано */
+            CLOSED,     /**< Соединение разорвано */
+        };
+
+        /** \brief Дождаться завершения перекрывающейся операции
+         */
+        inline BOOL complete_io(const BOOL success, OVERLAPPED &overlapped, DWORD &bytes) {
+            if (success) return TRUE;
+            if (GetLastError() != ERROR_IO_PENDING) return FALSE;
+            return GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+        }
+
+        /** \brief Передать прочитанное сообщение обработчикам
+         *
+         * Heartbeat сервера в on_message не передается. Кадры с контрольной
+         * суммой проверяются и раскрываются, сжатые кадры распаковываются.
+         * Сервер отвечает на согласование уже с контрольной суммой и затем
+         * добавляет ее ко всем сообщениям, поэтому после ответа сообщения
+         * без нее отклоняются, как и кадры с неверной суммой.
+         */
+        void dispatch_message(const char *data, size_t size) {
+            FrameHeader header;
+            const bool is_checked = parse_frame(data, size, header) && header.kind == FRAME_CHECKED;
+            if ((is_checked && !check_frame(header, data)) ||
+                (!is_checked && (features & FEATURE_CHECKSUM))) {
+                ++checksum_errors;
+                if (on_error) on_error(std::error_code(static_cast<int>(ERROR_CRC), std::generic_category()));
+                return;
+            }
+            if (is_checked) {
+                data += sizeof(FrameHeader);
+                size = header.size;
+            }
+            SIMPLE_NAMED_PIPE_TRACE_ID(trace_id, Trace::get_message_id(TRACE_FLOW_READ));
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_READ, trace_id);
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_BEGIN, trace_id);
+            if (parse_frame(data, size, header) && header.kind == FRAME_HELLO) {
+                // сервер подтверждает только возможности, которые мы запросили
+                uint32_t accepted = header.id & get_requested_features();
+                if (accepted & FEATURE_COMPRESSION) {
+                    HelloHeader hello;
+                    if (header.size < sizeof(HelloHeader)) {
+                        accepted &= ~static_cast<uint32_t>(FEATURE_COMPRESSION);
+                    } else {
+                        std::memcpy(&hello, data + sizeof(FrameHeader), sizeof(HelloHeader));
+                        if (hello.dictionary_id != compression->get_id()) accepted &= ~static_cast<uint32_t>(FEATURE_COMPRESSION);
+                    }
+                }
+                features = accepted;
+            } else
+            if (parse_frame(data, size, header) && header.kind == FRAME_COMPRESSED) {
+                BufferString message{ResourceAllocator<char>(memory_resource)};
+                if (compression && read_compressed_frame(header, data, *compression, message)) {
+                    dispatch_plain(message.data(), message.size());
+                } else
+                if (on_error) {
+                    on_error(std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+                }
+            } else {
+                dispatch_plain(data, size);
+            }
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_END, trace_id);
+        }
+
+        /** \brief Восстановить значение ключа из кадра FRAME_DELTA и передать его обработчикам
+         *
+         * Разность, которую нельзя применить, отбрасывается с ошибкой
+         * ERROR_INVALID_DATA, и ключ ждет следующего полного значения.
+         * \return Вернет true, если сообщение было кадром значения ключа
+         */
+        bool dispatch_delta(const char *data, const size_t size) {
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_DELTA) return false;
+            std::string key;
+            const char *body = nullptr;
+            size_t body_size = 0;
+            bool is_valid = parse_delta_frame(header, data, key, body, body_size);
+            if (is_valid) {
+                DeltaValue &entry = delta_values[key];
+                if (header.flags == DELTA_FULL) {
+                    entry.value.assign(body, body_size);
+                    entry.version = header.id;
+                } else
+                if (entry.version != 0 && entry.version + 1 == header.id &&
+                    apply_delta_patch(entry.value, body, body_size)) {
+                    entry.version = header.id;
+                } else {
+                    entry.version = 0;
+                    is_valid = false;
+                }
+                if (is_valid) dispatch_handlers(entry.value.data(), entry.value.size());
+            }
+            if (!is_valid && on_error) {
+                on_error(std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+            }
+            return true;
+        }
+
+        /** \brief Проверить, является ли сообщение heartbeat
+         */
+        inline bool is_heartbeat(const char *data, const size_t size) const noexcept {
+            return config.heartbeat_interval != 0 &&
+                size == config.heartbeat_message.size() &&
+                std::memcmp(data, config.heartbeat_message.data(), size) == 0;
+        }
+
+        /** \brief Передать несжатое сообщение обработчикам
+         *
+         * heartbeat сервера проверяется здесь, после распаковки, так как
+         * сервер может сжать его вместе с остальными сообщениями.
+         */
+        void dispatch_plain(const char *data, const size_t size) {
+            if (is_heartbeat(data, size)) return;
+            if (!dispatch_delta(data, size)) dispatch_handlers(data, size);
+        }
+
+        /** \brief Передать сообщение цепочке обработчиков
+         */
+        void dispatch_handlers(const char *data, const size_t size) {
+            if (!dispatch_channel(data, size) &&
+                !dispatch_chunk(data, size) &&
+                !dispatch_typed(data, size)) {
+                on_message(std::string(data, size));
+            }
+        }
+
+        /** \brief Записать сообщение в канал со сжатием и контрольной суммой, если сервер их подтвердил
+         *
+         * Преобразования выполняются при записи, а не при постановке в очередь:
+         * после переподключения сообщения из очереди не должны уйти на сервер,
+         * который эти возможности не согласовал.
+         * \param str              Сообщение
+         * \param is_overlapped    Канал открыт с FILE_FLAG_OVERLAPPED
+         * \return Вернет false при ошибке записи
+         */
+        bool write_message(const BufferString &str, const bool is_overlapped) {
+            const uint32_t accepted = features;
+            if (accepted == 0) return write_pipe(str, is_overlapped);
+            BufferString compressed{ResourceAllocator<char>(memory_resource)};
+            const bool is_compressed = (accepted & FEATURE_COMPRESSION) && str.size() >= min_compress_size &&
+                make_compressed_frame(str.data(), str.size(), *compression, compressed);
+            const BufferString &message = is_compressed ? compressed : str;
+            if (accepted & FEATURE_CHECKSUM) {
+                BufferString frame{ResourceAllocator<char>(memory_resource)};
+                make_checked_frame(message.data(), message.size(), frame);
+                return write_pipe(frame, is_overlapped);
+            }
+            return write_pipe(message, is_overlapped);
+        }
+
+        /** \brief Записать данные в канал без преобразований
+         * \param str              Данные
+         * \param is_overlapped    Канал открыт с FILE_FLAG_OVERLAPPED
+         * \return Вернет false при ошибке записи
+         */
+        bool write_pipe(const BufferString &str, const bool is_overlapped) {
+            DWORD bytes_written = 0;
+            BOOL success;
+            {
+                std::unique_lock<mutex_t> lock(pipe_mutex);
+                OVERLAPPED overlapped;
+                std::memset(&overlapped, 0, sizeof(overlapped));
+                overlapped.hEvent = io_event;
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_BEGIN, trace_write_id);
+                success = WriteFile(
+                    pipe,
+                    str.c_str(),        // буфер для записи
+                    str.size(),         // количество байтов для записи
+                    &bytes_written,     // количество записанных байтов
+                    is_overlapped ? &overlapped : NULL);
+                if (is_overlapped) success = complete_io(success, overlapped, bytes_written);
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_END, trace_write_id);
+            }
+
+            DWORD err = GetLastError();
+            if(!success || str.size() != bytes_written) {
+                on_error(std::error_code(static_cast<int>(err), std::generic_category()));
+                return false;
+            }
+            return true;
+        }
+
+        /** \brief Прочитать сообщение, если оно есть в канале
+         * \param read             Буфер чтения соединения
+         * \param is_overlapped    Канал открыт с FILE_FLAG_OVERLAPPED
+         * \return Результат чтения
+         */
+        ReadStatus read_message(ReadBuffer &read, const bool is_overlapped) {
+            /* проверяем наличие данных в кнале */
+            DWORD bytes_to_read = 0;
+            DWORD message_size = 0;
+            BOOL success;
+
+            {
+                std::unique_lock<mutex_t> lock(pipe_mutex);
+                success = PeekNamedPipe(pipe,NULL,0,NULL,&bytes_to_read,&message_size);
+            }
+
+            DWORD err = GetLastError();
+            if(!success) {
+                /* если соединение закрыто, вернется ERROR_PIPE_NOT_CONNECTED или ERROR_BROKEN_PIPE */
+                if(err == ERROR_PIPE_NOT_CONNECTED || err == ERROR_BROKEN_PIPE) return ReadStatus::CLOSED;
+            }
+            if(bytes_to_read == 0) return ReadStatus::EMPTY;
+
+            /* читаем данные */
+            DWORD bytes_read = 0;
+            if(message_size == 0) message_size = bytes_to_read;
+            /* буфер растет под крупное сообщение, но не больше max_buffer_size */
+            const size_t read_size = std::min((size_t)message_size, read.sizer.fit(message_size));
+            if(read.data.size() < read_size) {
+                BufferVector(std::max(read.size, read.sizer.fit(message_size)), 0, read.data.get_allocator()).swap(read.data);
+            }
+
+            {
+                std::unique_lock<mutex_t> lock(pipe_mutex);
+                OVERLAPPED overlapped;
+                std::memset(&overlapped, 0, sizeof(overlapped));
+                overlapped.hEvent = io_event;
+                success = ReadFile(
+                    pipe,
+                    &read.data[0],
+                    read_size,
+                    &bytes_read,
+                    is_overlapped ? &overlapped : NULL);
+                if (is_overlapped) success = complete_io(success, overlapped, bytes_read);
+            }
+
+            if(is_reset) return ReadStatus::CLOSED;
+            err = GetLastError();
+
+            if(!success) {
+                /* если соединение закрыто, вернется ERROR_PIPE_NOT_CONNECTED */
+                if(err == ERROR_PIPE_NOT_CONNECTED || err == ERROR_BROKEN_PIPE) return ReadStatus::CLOSED;
+                else if(err != ERROR_MORE_DATA) return ReadStatus::EMPTY;
+            }
+            /* в конце окна гистограммы уменьшаем буфер, если крупные сообщения не приходили */
+            if(bytes_read != 0) {
+                const size_t size = read.sizer.add(bytes_read);
+                if(size != 0) {
+                    read.size = size;
+                    if(read.data.size() > size) BufferVector(size, 0, read.data.get_allocator()).swap(read.data);
+                }
+            }
+            dispatch_message(read.data.data(), bytes_read);
+            return ReadStatus::MESSAGE;
+        }
+
+        /** \brief Подключиться к серверу без ожидания (режим опроса)
+         * \return Вернет true, если соединение установлено
+         */
+        bool connect_poll() {
+            const HANDLE handle = CreateFile(
+                (LPCSTR)poll_pipename.c_str(),
+                GENERIC_READ |
+                GENERIC_WRITE,
+                0,
+                NULL,
+                OPEN_EXISTING,
+                FILE_FLAG_OVERLAPPED,   // ожидание данных чтением нуля байт
+                NULL);
+            /* сервер не запущен или все экземпляры заняты, повторим в следующем poll_once() */
+            if(handle == INVALID_HANDLE_VALUE) return false;
+
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            if(!SetNamedPipeHandleState(handle, &mode, NULL, NULL)) {
+                const DWORD err = GetLastError();
+                CloseHandle(handle);
+                if(on_error) on_error(std::error_code(static_cast<int>(err), std::generic_category()));
+                return false;
+            }
+            {
+                std::lock_guard<mutex_t> lock(pipe_mutex);
+                pipe = handle;
+            }
+            poll_buffer.reset(new ReadBuffer(memory_resource, config));
+            poll_last_send = std::chrono::steady_clock::now();
+            is_connect = true;
+            push_hello();
+            on_open();
+            return true;
+        }
+
+        /** \brief Закрыть соединение режима опроса
+         */
+        void close_poll() {
+            is_connect = false;
+            is_poll_closed = true;
+            {
+                std::lock_guard<mutex_t> lock(pipe_mutex);
+                if(is_read_pending) {
+                    CancelIo(pipe);
+                    DWORD bytes = 0;
+                    GetOverlappedResult(pipe, &read_overlapped, &bytes, TRUE);
+                    is_read_pending = false;
+                }
+                CloseHandle(pipe);
+                pipe = INVALID_HANDLE_VALUE;
+            }
+            poll_buffer.reset();
+            close_channels();
+            on_close();
+        }
+
+        /** \brief Проверить, завершилось ли ожидание данных
+         */
+        bool is_read_ready() {
+            if(!is_read_pending) return true;
+            DWORD bytes = 0;
+            if(!GetOverlappedResult(pipe, &read_overlapped, &bytes, FALSE) &&
+               GetLastError() == ERROR_IO_INCOMPLETE) return false;
+            is_read_pending = false;
+            return true;
+        }
+
+        /** \brief Начать ожидание данных чтением нуля байт
+         *
+         * Чтение завершается с приходом сообщения, не извлекая его из канала,
+         * и переводит read_event в сигнальное состояние.
+         */
+        void arm_read() {
+            std::lock_guard<mutex_t> lock(pipe_mutex);
+            if(is_read_pending || pipe == INVALID_HANDLE_VALUE) return;
+            std::memset(&read_overlapped, 0, sizeof(read_overlapped));
+            read_overlapped.hEvent = read_event;
+            ResetEvent(read_event);
+            char dummy = 0;
+            if(!ReadFile(pipe, &dummy, 0, NULL, &read_overlapped) &&
+               GetLastError() == ERROR_IO_PENDING) {
+                is_read_pending = true;
+            }
+        }
+
         /** \brief Инициализировать сервер
          *
          * \param config Настройки сервера
          * \return Вернет true, если инициализация прошла успешно
          */
         bool init(Config &config) {
-            if(named_pipe_future.valid()) return false;
+            static_assert(!LockPolicy::is_single_threaded,
+                "SingleThreadedLock: the client must not start its own threads, use start_poll()");
+            if(named_pipe_future.valid() || is_poll) return false;
 
             //if(on_open == nullptr ||
             //    on_message == nullptr ||
             //    on_close == nullptr ||
             //    on_error == nullptr) return false;
 
+            is_inproc = InprocRegistry::is_inproc_name(config.name);
+            if(is_inproc) {
+                const std::string name = config.name.substr(sizeof(INPROC_PREFIX) - 1);
+                named_pipe_future = std::async(std::launch::async,[this, name]() {
+                    run_inproc(name);
+                });
+                return true;
+            }
+
             std::string pipename("\\\\.\\pipe\\");
             if(config.name.find("\\") != std::string::npos) return false;
             pipename += config.name;
@@ -82,10 +828,15 @@ namespace SimpleNamedPipe {
                     this,
                     pipename,
                     config]() {
+                /* без переподключения пауза между попытками постоянна */
+                const bool is_reconnect = config.reconnect_min_delay != 0;
+                const size_t min_delay = is_reconnect ? config.reconnect_min_delay : 10;
+                const size_t max_delay = is_reconnect ? std::max(config.reconnect_min_delay, config.reconnect_max_delay) : 10;
                 while(!is_reset) {
                     /* устанавливаем связь с сервером */
+                    size_t delay = min_delay;
                     while(!is_reset) {
-                        std::unique_lock<std::mutex> lock(pipe_mutex);
+                        std::unique_lock<mutex_t> lock(pipe_mutex);
                         pipe = CreateFile(
                             (LPCSTR)pipename.c_str(), // имя канала
                             GENERIC_READ |  // read and write access
@@ -99,20 +850,11 @@ namespace SimpleNamedPipe {
                         /* Выходим из цикла, если есть соединение (хендл валидный) */
                         if(pipe != INVALID_HANDLE_VALUE) break;
 
-                        /* Повторяем попытку, если возникает ошибка, отличная от ERROR_PIPE_BUSY */
-                        if(GetLastError() != ERROR_PIPE_BUSY) {
-                            //on_error(std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
-                            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                            continue;
-                        }
-
-                        const size_t DELAY = 1000;
-                        /* Все экземпляры канала заняты, поэтому подождите */
-                        if(!WaitNamedPipe((LPCSTR)pipename.c_str(), DELAY))  {
-                            std::cerr << "Could not open pipe: " << (DELAY / 1000) << " second wait timed out." << std::endl;
-                            continue;
-                        }
-
+                        /* Сервер недоступен или все экземпляры канала заняты (ERROR_PIPE_BUSY):
+                         * ждем паузу, которую прерывает stop(), и проверяем сервер все реже */
+                        lock.unlock();
+                        WaitForSingleObject(stop_event, static_cast<DWORD>(delay));
+                        delay = std::min(delay * 2, max_delay);
                     } // while
                     if (is_reset) return;
 
@@ -128,7 +870,7 @@ namespace SimpleNamedPipe {
                      * GENERIC_READ и FILE_WRITE_ATTRIBUTES
                      */
                     DWORD mode = PIPE_READMODE_MESSAGE;
-                    std::unique_lock<std::mutex> lock(pipe_mutex);
+                    std::unique_lock<mutex_t> lock(pipe_mutex);
                     BOOL success = SetNamedPipeHandleState(
                         pipe,
                         &mode,
@@ -143,6 +885,7 @@ namespace SimpleNamedPipe {
                     }
 
                     is_connect = true;
+                    push_hello();
 
                     lock.unlock();
                     on_open();
@@ -158,93 +901,178 @@ namespace SimpleNamedPipe {
 
                     lock.unlock();
 
+                    auto last_send = std::chrono::steady_clock::now();
+                    /* буфер чтения выделяется один раз на соединение и следует за размерами сообщений */
+                    ReadBuffer read_buffer(memory_resource, config);
                     while(!is_reset && is_connect) {
+                        /* отправляем heartbeat, если давно ничего не отправляли */
+                        if(config.heartbeat_interval != 0) {
+                            const auto now = std::chrono::steady_clock::now();
+                            if((now - last_send) >= std::chrono::milliseconds(config.heartbeat_interval)) {
+                                push_message(make_message(config.heartbeat_message.data(), config.heartbeat_message.size()), Priority::HIGH);
+                                last_send = now;
+                            }
+                        }
+
                         /* отправляем данные */
-                        size_t queue_messages_size = 0;
+                        BufferString str{ResourceAllocator<char>(memory_resource)};
+                        bool is_message = false;
                         {
-                            std::lock_guard<std::mutex> lock(queue_messages_mutex);
-                            queue_messages_size = queue_messages.size();
+                            std::lock_guard<mutex_t> lock(queue_messages_mutex);
+                            is_message = pop_message(str);
                         }
-                        if(queue_messages_size != 0) {
-                            std::string str;
-                            {
-                                std::lock_guard<std::mutex> lock(queue_messages_mutex);
-                                str = queue_messages.front();
-                                queue_messages.pop();
-                            }
-                            DWORD bytes_written = 0;
-                            BOOL success;
-
-                            {
-                                std::unique_lock<std::mutex> lock(pipe_mutex);
-                                success = WriteFile(
-                                    pipe,
-                                    str.c_str(),        // буфер для записи
-                                    str.size(),         // количество байтов для записи
-                                    &bytes_written,     // количество записанных байтов
-                                    NULL);              // не перекрывается I/O
-                            }
-
-                            DWORD err = GetLastError();
-                            if(!success || str.size() != bytes_written) {
-                                /* ошибка записи, закрываем соединение */
-                                on_error(std::error_code(static_cast<int>(err), std::generic_category()));
+                        if(is_message) {
+                            if(!write_message(str, false)) {
+                                /* ошибка записи, закрываем соединение, сообщение отправится после переподключения */
                                 is_connect = false;
+                                requeue_message(std::move(str));
                                 break;
                             }
+                            last_send = std::chrono::steady_clock::now();
                         }
 
-                        /* проверяем наличие данных в кнале */
-                        DWORD bytes_to_read = 0;
-
-                        {
-                            std::unique_lock<std::mutex> lock(pipe_mutex);
-                            success = PeekNamedPipe(pipe,NULL,0,NULL,&bytes_to_read,NULL);
-                        }
-
-                        DWORD err = GetLastError();
-                        if(!success) {
-                            /* если соединение закрыто, вернется ERROR_PIPE_NOT_CONNECTED */
-                            if(err == ERROR_PIPE_NOT_CONNECTED)  break;
-                        }
-                        if(bytes_to_read == 0) continue;
-
                         /* читаем данные */
-                        DWORD bytes_read = 0;
-                        std::vector<char> buf(config.buffer_size);
-
-                        {
-                            std::unique_lock<std::mutex> lock(pipe_mutex);
-                            success = ReadFile(
-                                pipe,
-                                &buf[0],
-                                config.buffer_size,
-                                &bytes_read,
-                                NULL);
-                        }
-
-
-                        if(is_reset) break;
-                        err = GetLastError();
-
-                        if(!success) {
-                            /* если соединение закрыто, вернется ERROR_PIPE_NOT_CONNECTED */
-                            if(err == ERROR_PIPE_NOT_CONNECTED)  break;
-                            else if(err != ERROR_MORE_DATA) continue;
-                        }
-                        on_message(std::string(buf.begin(),buf.begin() + bytes_read));
+                        if(read_message(read_buffer, false) == ReadStatus::CLOSED) break;
                     } // while
                     is_connect = false;
+                    close_channels();
                     on_close();
                     {
-                        std::unique_lock<std::mutex> lock(pipe_mutex);
+                        std::unique_lock<mutex_t> lock(pipe_mutex);
                         CloseHandle(pipe);
+                        pipe = INVALID_HANDLE_VALUE;
                     }
-                    break;
+                    if(!is_reconnect) break;
                 }
             });
             return true;
         }
+
+        /** \brief Обработчик двоичного сообщения, возвращает false при неверном размере данных */
+        using typed_handler_t = std::function<bool(const char*, size_t)>;
+        std::unordered_map<uint32_t, typed_handler_t> typed_handlers;
+
+        /** \brief Передать кадр двоичного сообщения его обработчику
+         * \return Вернет true, если сообщение обработано
+         */
+        bool dispatch_typed(const char *data, const size_t size) {
+            if (typed_handlers.empty()) return false;
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_TYPED) return false;
+            auto it = typed_handlers.find(header.id);
+            if (it == typed_handlers.end()) return false;
+            if (!it->second(data + sizeof(FrameHeader), header.size)) {
+                if (on_error) on_error(std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+            }
+            return true;
+        }
+        /** \brief Обработать кадр логического канала
+         * \return Вернет true, если сообщение было кадром канала
+         */
+        bool dispatch_channel(const char *data, const size_t size) {
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_CHANNEL) return false;
+            std::shared_ptr<Channel> channel;
+            {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                auto it = channels.find(header.id);
+                if (it == channels.end()) return true;
+                channel = it->second;
+                if (header.flags == CHANNEL_CLOSE) channels.erase(it);
+            }
+            if (header.flags == CHANNEL_CLOSE) {
+                if (channel->on_close) channel->on_close();
+            } else
+            if (header.flags == CHANNEL_DATA && channel->on_message) {
+                channel->on_message(std::string(data + sizeof(FrameHeader), header.size));
+            }
+            return true;
+        }
+
+        /** \brief Передать кадр части объемной передачи в on_chunk
+         * \return Вернет true, если сообщение было кадром части
+         */
+        bool dispatch_chunk(const char *data, const size_t size) {
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_CHUNK) return false;
+            if (header.size < sizeof(ChunkHeader)) {
+                if (on_error) on_error(std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+                return true;
+            }
+            ChunkHeader chunk;
+            std::memcpy(&chunk, data + sizeof(FrameHeader), sizeof(ChunkHeader));
+            if (on_chunk) {
+                on_chunk(header.id, chunk.offset, chunk.total,
+                    data + CHUNK_FRAME_OVERHEAD, header.size - sizeof(ChunkHeader));
+            }
+            return true;
+        }
+
+        /** \brief Сообщить об ошибке синхронного режима и закрыть его канал
+         */
+        void transact_error(const DWORD err) {
+            if (transact_pipe != INVALID_HANDLE_VALUE) {
+                CloseHandle(transact_pipe);
+                transact_pipe = INVALID_HANDLE_VALUE;
+            }
+            if (on_error) on_error(std::error_code(static_cast<int>(err), std::generic_category()));
+        }
+
+        /** \brief Открыть канал синхронного режима
+         * \param timeout Время ожидания свободного экземпляра канала, мс
+         * \return Вернет true, если канал открыт
+         */
+        bool open_transact_pipe(const size_t timeout) {
+            if (transact_pipe != INVALID_HANDLE_VALUE) return true;
+            std::string pipename("\\\\.\\pipe\\");
+            if (config.name.find("\\") != std::string::npos) return false;
+            pipename += config.name;
+
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                transact_pipe = CreateFile(
+                    (LPCSTR)pipename.c_str(),
+                    GENERIC_READ |
+                    GENERIC_WRITE,
+                    0,
+                    NULL,
+                    OPEN_EXISTING,
+                    FILE_FLAG_OVERLAPPED,   // операции с тайм-аутом
+                    NULL);
+                if (transact_pipe != INVALID_HANDLE_VALUE) break;
+                if (GetLastError() != ERROR_PIPE_BUSY ||
+                    !WaitNamedPipe((LPCSTR)pipename.c_str(), static_cast<DWORD>(timeout))) {
+                    transact_error(GetLastError());
+                    return false;
+                }
+            }
+            if (transact_pipe == INVALID_HANDLE_VALUE) {
+                transact_error(GetLastError());
+                return false;
+            }
+
+            DWORD mode = PIPE_READMODE_MESSAGE;
+            if (!SetNamedPipeHandleState(transact_pipe, &mode, NULL, NULL)) {
+                transact_error(GetLastError());
+                return false;
+            }
+            return true;
+        }
+
+        /** \brief Дождаться завершения операции синхронного режима
+         * \return Код ошибки Win32 или ERROR_SUCCESS
+         */
+        DWORD wait_transact(OVERLAPPED &overlapped, DWORD &bytes, const size_t timeout) {
+            const DWORD err = GetLastError();
+            if (err != ERROR_IO_PENDING) return err;
+            if (WaitForSingleObject(transact_event, static_cast<DWORD>(timeout)) != WAIT_OBJECT_0) {
+                CancelIo(transact_pipe);
+                GetOverlappedResult(transact_pipe, &overlapped, &bytes, TRUE);
+                return ERROR_TIMEOUT;
+            }
+            if (GetOverlappedResult(transact_pipe, &overlapped, &bytes, FALSE)) return ERROR_SUCCESS;
+            return GetLastError();
+        }
+
     public:
 
         std::function<void()> on_open;
@@ -252,44 +1080,478 @@ namespace SimpleNamedPipe {
         std::function<void()> on_close;
         std::function<void(const std::error_code &)> on_error;
 
+        /** \brief Часть объемной передачи send_file или send_region сервера
+         *
+         * Данные действительны только во время вызова. Передача завершена,
+         * когда offset + size == total.
+         */
+        std::function<void(uint32_t transfer, uint64_t offset, uint64_t total, const char *data, size_t size)> on_chunk;
+
         /** \brief Конструктор класса
          * \param name Имя именнованного канала
          * \param buffer_size Размер буфера
          */
-        NamedPipeClient(
+        BasicNamedPipeClient(
             const std::string &name,
             const size_t buffer_size = 1024) {
             is_reset = false;
             is_connect = false;
+            features = 0;
+            checksum_errors = 0;
+#           ifdef SIMPLE_NAMED_PIPE_TRACE
+            // у каждого клиента свой диапазон номеров, чтобы потоки трассировки не пересекались
+            const uint64_t trace_base = Trace::get_queue_base();
+            for (uint64_t &seq : trace_enqueue_seq) seq = trace_base;
+            for (uint64_t &seq : trace_dequeue_seq) seq = trace_base;
+#           endif
+            stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            transact_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            io_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            read_event = CreateEvent(NULL, TRUE, FALSE, NULL);
             config.name = name;
             config.buffer_size = buffer_size;
         }
 
         /** \brief Отправить сообщение
          * \param out_message Сообщение
+         * \param priority Приоритет сообщения
          * \return Вернет true в случае успеха
          */
-        bool send(const std::string &out_message) {
+        bool send(const std::string &out_message, const Priority priority = Priority::NORMAL) {
             if(!is_connect) return false;
-            std::lock_guard<std::mutex> lock(queue_messages_mutex);
-            queue_messages.push(out_message);
+            if(is_inproc) return write_inproc(std::string(out_message));
+            push_message(make_message(out_message.data(), out_message.size()), priority);
             return true;
         }
 
+        /** \brief Отправить сообщение, передав владение строкой
+         *
+         * При подключении внутри процесса строка перемещается в очередь
+         * сервера без копирования.
+         * \param out_message Сообщение
+         * \param priority Приоритет сообщения
+         * \return Вернет true в случае успеха
+         */
+        bool send(std::string &&out_message, const Priority priority = Priority::NORMAL) {
+            if(!is_connect) return false;
+            if(is_inproc) return write_inproc(std::move(out_message));
+            push_message(make_message(out_message.data(), out_message.size()), priority);
+            return true;
+        }
+
+        /** \brief Отправить двоичное сообщение
+         *
+         * Кадр собирается сразу в строке очереди, без форматирования.
+         * \param out_message Сообщение, тип объявлен через SIMPLE_NAMED_PIPE_MESSAGE_TYPE
+         * \param priority Приоритет сообщения
+         * \return Вернет true в случае успеха
+         */
+        template<class T>
+        typename std::enable_if<MessageType<T>::is_message, bool>::type send(
+                const T &out_message,
+                const Priority priority = Priority::NORMAL) {
+            if(!is_connect) return false;
+            if(is_inproc) {
+                std::string frame(sizeof(FrameHeader) + sizeof(T), '\0');
+                write_typed_frame(out_message, &frame[0]);
+                return write_inproc(std::move(frame));
+            }
+            BufferString frame(sizeof(FrameHeader) + sizeof(T), '\0', ResourceAllocator<char>(memory_resource));
+            write_typed_frame(out_message, &frame[0]);
+            push_message(std::move(frame), priority);
+            return true;
+        }
+
+        /** \brief Установить обработчик двоичного сообщения
+         *
+         * Обработчики устанавливаются до запуска клиента.
+         * Кадры зарегистрированных типов не передаются в on_message.
+         * \param handler Обработчик сообщения, тип объявлен через SIMPLE_NAMED_PIPE_MESSAGE_TYPE
+         */
+        template<class T>
+        void on_typed_message(std::function<void(const T &in_message)> handler) {
+            static_assert(MessageType<T>::is_message, "Type is not declared with SIMPLE_NAMED_PIPE_MESSAGE_TYPE");
+            typed_handlers[MessageType<T>::id] = [handler](const char *data, size_t size) {
+                return dispatch_typed_frame<T>(data, size, handler);
+            };
+        }
+
         void close() {
             is_reset = true;
         }
 
+        /** \brief Открыть логический канал
+         *
+         * Логические каналы мультиплексируются в одном соединении, поэтому
+         * сервер не создает для них отдельных экземпляров канала и потоков.
+         * Обработчики вызываются в потоке клиента.
+         * \param channel     Номер канала, выбирается клиентом
+         * \param on_message  Обработчик сообщений канала
+         * \param on_close    Обработчик закрытия канала сервером или разрыва соединения
+         * \return Вернет false, если нет соединения или канал уже открыт
+         */
+        bool open_channel(
+                const uint32_t channel,
+                std::function<void(const std::string &in_message)> on_message,
+                std::function<void()> on_close = nullptr) {
+            if(!is_connect) return false;
+            std::shared_ptr<Channel> handlers = std::make_shared<Channel>();
+            handlers->on_message = std::move(on_message);
+            handlers->on_close = std::move(on_close);
+            {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                if (!channels.emplace(channel, handlers).second) return false;
+            }
+            if (!push_channel_frame(channel, CHANNEL_OPEN, nullptr, 0)) {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                channels.erase(channel);
+                return false;
+            }
+            return true;
+        }
+
+        /** \brief Отправить сообщение в логический канал
+         * \param channel     Номер открытого канала
+         * \param out_message Сообщение
+         * \return Вернет false, если канал не открыт
+         */
+        bool send_channel(const uint32_t channel, const std::string &out_message) {
+            if(!is_connect) return false;
+            {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                if (channels.find(channel) == channels.end()) return false;
+            }
+            return push_channel_frame(channel, CHANNEL_DATA, out_message.data(), out_message.size());
+        }
+
+        /** \brief Закрыть логический канал
+         *
+         * Обработчик on_close канала не вызывается.
+         * \param channel Номер канала
+         * \return Вернет false, если канал не открыт
+         */
+        bool close_channel(const uint32_t channel) {
+            {
+                std::lock_guard<mutex_t> lock(channels_mutex);
+                if (channels.erase(channel) == 0) return false;
+            }
+            if(!is_connect) return true;
+            push_channel_frame(channel, CHANNEL_CLOSE, nullptr, 0);
+            return true;
+        }
+
+        /** \brief Установить границы размера буфера чтения
+         *
+         * Буфер начинается с buffer_size, растет под крупные сообщения
+         * до max_size и уменьшается до min_size при небольших сообщениях.
+         * Устанавливается до запуска клиента.
+         * \param min_size Наименьший размер буфера
+         * \param max_size Наибольший размер буфера, более крупные сообщения читаются частично
+         */
+        void set_buffer_limits(const size_t min_size, const size_t max_size) {
+            config.min_buffer_size = min_size;
+            config.max_buffer_size = max_size;
+        }
+
+        /** \brief Установить источник памяти
+         *
+         * Из него выделяются очереди исходящих сообщений вместе с блоками
+         * самих очередей и буфер чтения. Источник должен существовать
+         * дольше клиента. Устанавливается до запуска клиента, сообщения,
+         * уже поставленные в очередь, сохраняются.
+         * \param resource Источник памяти, nullptr - глобальная куча
+         */
+        void set_memory_resource(MemoryResource *resource) {
+            std::lock_guard<mutex_t> lock(queue_messages_mutex);
+            memory_resource = resource ? resource : AllocatorPolicy::get_memory_resource();
+            rebind_queue(queue_messages, memory_resource);
+            rebind_queue(queue_messages_high, memory_resource);
+            // каналы открываются после подключения, до запуска их очереди пусты
+            if (channel_queues.empty()) channel_queues = ChannelQueues(ResourceAllocator<BufferString>(memory_resource));
+            if (ready_channels.empty()) ready_channels = ChannelDeque(ResourceAllocator<BufferString>(memory_resource));
+        }
+
+        /** \brief Включить сжатие сообщений общим словарем
+         *
+         * После подключения клиент предлагает серверу сжатие, и оно
+         * используется в обе стороны, только если сервер включил сжатие
+         * тем же словарем. Канал внутри процесса (inproc:) не сжимается.
+         * Устанавливается до запуска клиента.
+         * \param dictionary    Словарь, nullptr - выключить сжатие
+         * \param min_size      Сообщения короче не сжимаются
+         */
+        void set_compression(
+                std::shared_ptr<const CompressionDictionary> dictionary,
+                const size_t min_size = 128) {
+            compression = std::move(dictionary);
+            min_compress_size = min_size;
+        }
+
+        /** \brief Включить переподключение после разрыва соединения
+         *
+         * Недоступный сервер проверяется с экспоненциально растущей паузой:
+         * от min_delay до max_delay, после подключения пауза сбрасывается.
+         * Без переподключения клиент после разрыва останавливается, а до
+         * первого подключения пытается подключиться каждые 10 мс.
+         * Работает в потоковом режиме, устанавливается до запуска клиента.
+         * \param min_delay Начальная пауза, мс, 0 - выключить переподключение
+         * \param max_delay Наибольшая пауза, мс
+         */
+        void set_reconnect_backoff(const size_t min_delay, const size_t max_delay) {
+            config.reconnect_min_delay = min_delay;
+            config.reconnect_max_delay = max_delay;
+        }
+
+        /** \brief Перенести неотправленные сообщения в очередь другого клиента
+         *
+         * Сообщения send() сохраняют приоритет и порядок. Кадры согласования
+         * и heartbeat этого соединения не переносятся, очереди логических
+         * каналов остаются на месте: каналы закрываются вместе с соединением.
+         * \param other Клиент, который отправит сообщения
+         * \return Количество перенесенных сообщений
+         */
+        size_t move_outbox(BasicNamedPipeClient &other) {
+            if (&other == this) return 0;
+            MessageQueue high;
+            MessageQueue normal;
+            {
+                std::lock_guard<mutex_t> lock(queue_messages_mutex);
+                high.swap(queue_messages_high);
+                normal.swap(queue_messages);
+                // перенесенные сообщения считаются извлеченными из очередей этого клиента,
+                // в очереди другого клиента они получат его номера трассировки
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_dequeue_seq[0], trace_enqueue_seq[0]);
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_dequeue_seq[1], trace_enqueue_seq[1]);
+            }
+            size_t count = 0;
+            for (; !high.empty(); high.pop()) {
+                if (is_control_message(high.front())) continue;
+                other.push_message(std::move(high.front()), Priority::HIGH);
+                ++count;
+            }
+            for (; !normal.empty(); normal.pop()) {
+                other.push_message(std::move(normal.front()), Priority::NORMAL);
+                ++count;
+            }
+            return count;
+        }
+
+        /** \brief Запросить контрольную сумму сообщений
+         *
+         * После подключения клиент предлагает серверу контрольную сумму CRC32C,
+         * и она добавляется к сообщениям в обе стороны, если сервер ее разрешил.
+         * Сообщения с неверной суммой не передаются обработчикам, вызывается
+         * on_error с ERROR_CRC. Устанавливается до запуска клиента.
+         * \param value Запросить контрольную сумму
+         */
+        void set_checksum(const bool value) {
+            is_checksum = value;
+        }
+
+        /** \brief Запросить разностное кодирование рассылки
+         *
+         * Значения ключей из send_all_keyed() сервера приходят разностями
+         * с предыдущим значением ключа, клиент восстанавливает полное значение
+         * и передает его в on_message. Используется, если сервер включил
+         * разностное кодирование. Устанавливается до запуска клиента.
+         * \param value Запросить разностное кодирование
+         */
+        void set_delta(const bool value) {
+            is_delta = value;
+        }
+
+        /** \brief Включить heartbeat
+         *
+         * Если клиент ничего не отправлял в течение interval, он отправляет
+         * серверу сообщение heartbeat. Пока interval не равен 0, входящие
+         * сообщения, равные message, не передаются в on_message. Если
+         * interval равен 0, такие сообщения приходят в on_message как
+         * обычные данные. Устанавливается до запуска клиента.
+         * \param interval  Период, мс, 0 - отключить
+         * \param message   Сообщение heartbeat
+         */
+        void set_heartbeat(const size_t interval, const std::string &message = "{\"heartbeat\":1}") {
+            config.heartbeat_interval = interval;
+            config.heartbeat_message = message;
+        }
+
+        /** \brief Отправить запрос и дождаться ответа в текущем потоке
+         *
+         * Синхронный режим без фонового потока и очереди сообщений,
+         * запись и чтение выполняются одной операцией TransactNamedPipe.
+         * Нельзя использовать вместе с start(). Канал открывается при первом
+         * вызове и остается открытым до stop() или ошибки.
+         * Ошибки передаются в on_error, тайм-аут - как ERROR_TIMEOUT.
+         * \param request   Запрос
+         * \param reply     Ответ, память строки переиспользуется между вызовами
+         * \param timeout   Время ожидания ответа, мс
+         * \return Вернет true, если ответ получен
+         */
+        bool transact(const std::string &request, std::string &reply, const size_t timeout = 1000) {
+            if (named_pipe_future.valid() || is_poll) return false;
+            std::lock_guard<mutex_t> lock(transact_mutex);
+            if (transact_event == NULL) return false;
+            if (!open_transact_pipe(timeout)) return false;
+
+            OVERLAPPED overlapped;
+            std::memset(&overlapped, 0, sizeof(overlapped));
+            overlapped.hEvent = transact_event;
+
+            reply.resize(config.buffer_size);
+            DWORD bytes_read = 0;
+            BOOL success = TransactNamedPipe(
+                transact_pipe,
+                (LPVOID)request.data(),
+                static_cast<DWORD>(request.size()),
+                &reply[0],
+                static_cast<DWORD>(reply.size()),
+                &bytes_read,
+                &overlapped);
+            DWORD err = success ? ERROR_SUCCESS : wait_transact(overlapped, bytes_read, timeout);
+
+            // ответ больше буфера, дочитываем остаток сообщения
+            size_t reply_size = bytes_read;
+            while (err == ERROR_MORE_DATA) {
+                reply.resize(reply_size + config.buffer_size);
+                std::memset(&overlapped, 0, sizeof(overlapped));
+                overlapped.hEvent = transact_event;
+                bytes_read = 0;
+                success = ReadFile(
+                    transact_pipe,
+                    &reply[reply_size],
+                    static_cast<DWORD>(config.buffer_size),
+                    &bytes_read,
+                    &overlapped);
+                err = success ? ERROR_SUCCESS : wait_transact(overlapped, bytes_read, timeout);
+                reply_size += bytes_read;
+            }
+
+            if (err != ERROR_SUCCESS) {
+                reply.clear();
+                transact_error(err);
+                return false;
+            }
+            reply.resize(reply_size);
+            return true;
+        }
+
         /** \brief Запустить сервер
          */
         bool start() {
             return init(config);
         }
 
+        /** \brief Запустить клиент в режиме опроса
+         *
+         * Клиент не создает потоков: подключение и чтение выполняются
+         * в poll_once(), запись очереди send() - в flush(). Оба метода
+         * вызываются из цикла событий приложения, который ждет хендлеры
+         * get_wait_handles() не дольше get_poll_timeout(). Обработчики
+         * вызываются в потоке цикла. Как и в потоковом режиме, после разрыва
+         * соединения клиент не переподключается до stop() и нового запуска.
+         * Подключение внутри процесса (inproc:) в этом режиме недоступно.
+         * \return Вернет true, если режим опроса запущен
+         */
+        bool start_poll() {
+            if(is_poll || named_pipe_future.valid()) return false;
+            if(InprocRegistry::is_inproc_name(config.name)) return false;
+            if(config.name.find("\\") != std::string::npos) return false;
+            poll_pipename = "\\\\.\\pipe\\" + config.name;
+            if(poll_pipename.length() > 256) return false;
+            if(io_event == NULL || read_event == NULL) return false;
+            is_reset = false;
+            is_poll = true;
+            is_poll_closed = false;
+            connect_poll();
+            return true;
+        }
+
+        /** \brief Выполнить готовую работу клиента без ожидания (режим опроса)
+         *
+         * Подключается к серверу, если соединения еще нет, ставит heartbeat
+         * в очередь и читает готовые сообщения.
+         * \param max_messages Наибольшее количество сообщений за вызов
+         * \return Количество прочитанных сообщений
+         */
+        size_t poll_once(const size_t max_messages = SIZE_MAX) {
+            if(!is_poll || is_poll_closed) return 0;
+            if(!is_connect && !connect_poll()) return 0;
+            if(config.heartbeat_interval != 0) {
+                const auto now = std::chrono::steady_clock::now();
+                if((now - poll_last_send) >= std::chrono::milliseconds(config.heartbeat_interval)) {
+                    push_message(make_message(config.heartbeat_message.data(), config.heartbeat_message.size()), Priority::HIGH);
+                    poll_last_send = now;
+                }
+            }
+            size_t counter = 0;
+            while(counter < max_messages && is_connect && is_read_ready()) {
+                const ReadStatus status = read_message(*poll_buffer, true);
+                if(status == ReadStatus::CLOSED) {
+                    close_poll();
+                    return counter;
+                }
+                if(status == ReadStatus::EMPTY) break;
+                ++counter;
+            }
+            if(is_connect) arm_read();
+            return counter;
+        }
+
+        /** \brief Записать сообщения очереди в канал (режим опроса)
+         * \return Количество записанных сообщений
+         */
+        size_t flush() {
+            if(!is_poll || !is_connect) return 0;
+            size_t counter = 0;
+            BufferString str{ResourceAllocator<char>(memory_resource)};
+            while(is_connect) {
+                {
+                    std::lock_guard<mutex_t> lock(queue_messages_mutex);
+                    if(!pop_message(str)) break;
+                }
+                if(!write_message(str, true)) {
+                    /* ошибка записи, закрываем соединение, сообщение отправится после переподключения */
+                    requeue_message(std::move(str));
+                    close_poll();
+                    break;
+                }
+                poll_last_send = std::chrono::steady_clock::now();
+                ++counter;
+            }
+            return counter;
+        }
+
+        /** \brief Получить хендлеры ожидания для цикла событий (режим опроса)
+         *
+         * Хендлер переходит в сигнальное состояние, когда в канале есть данные
+         * для poll_once(). Пока соединения нет, список пуст.
+         * \param handles Хендлеры
+         */
+        void get_wait_handles(std::vector<HANDLE> &handles) {
+            handles.clear();
+            if(is_poll && is_connect) handles.push_back(read_event);
+        }
+
+        /** \brief Наибольшее время ожидания до следующего poll_once(), мс
+         *
+         * Пока соединения нет, цикл должен повторять подключение, при
+         * включенном heartbeat - просыпаться для его отправки.
+         */
+        inline DWORD get_poll_timeout() const {
+            if(is_poll && !is_connect && !is_poll_closed) return 10;
+            if(config.heartbeat_interval != 0) return static_cast<DWORD>(config.heartbeat_interval);
+            return INFINITE;
+        }
+
         /** \brief Остановить сервер
          */
         void stop() {
+            if(is_poll) {
+                if(is_connect) close_poll();
+                is_poll = false;
+            }
             is_reset = true;
+            if (stop_event != NULL) SetEvent(stop_event);
             if(named_pipe_future.valid()) {
                 try {
                     named_pipe_future.wait();
@@ -298,6 +1560,12 @@ namespace SimpleNamedPipe {
                 catch(...) {}
             }
             is_reset = false;
+            if (stop_event != NULL) ResetEvent(stop_event);
+            std::lock_guard<mutex_t> lock(transact_mutex);
+            if (transact_pipe != INVALID_HANDLE_VALUE) {
+                CloseHandle(transact_pipe);
+                transact_pipe = INVALID_HANDLE_VALUE;
+            }
         }
 
         /** \brief Проверить соединение
@@ -308,14 +1576,28 @@ namespace SimpleNamedPipe {
         }
 
         inline HANDLE get_handle() {
-            std::unique_lock<std::mutex> lock(pipe_mutex);
+            std::unique_lock<mutex_t> lock(pipe_mutex);
             return pipe;
         }
 
-        ~NamedPipeClient() {
+        /** \brief Входящих сообщений с неверной или отсутствующей контрольной суммой
+         */
+        inline uint64_t get_checksum_errors() const noexcept {
+            return checksum_errors;
+        }
+
+        ~BasicNamedPipeClient() {
             stop();
+            if (stop_event != NULL) CloseHandle(stop_event);
+            if (transact_event != NULL) CloseHandle(transact_event);
+            if (io_event != NULL) CloseHandle(io_event);
+            if (read_event != NULL) CloseHandle(read_event);
         }
     };
+
+    /** \brief Клиент именованных каналов с политиками по умолчанию
+     */
+    using NamedPipeClient = BasicNamedPipeClient<>;
 }
 
 #endif // SIMPLE_NAMED_PIPE_CLIENT_HPP_INCLUDED
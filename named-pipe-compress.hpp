@@ -0,0 +1,438 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_COMPRESS_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_COMPRESS_HPP_INCLUDED
+
+#include "named-pipe-frame.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/** \file
+ * Сжатие сообщений алгоритмом семейства LZ с общим словарем.
+ *
+ * Формат блока повторяет последовательности LZ4: байт-токен с длинами
+ * литералов и совпадения, литералы, смещение совпадения (2 байта) и
+ * продолжения длин байтами 255. Смещение может указывать в словарь,
+ * который считается расположенным непосредственно перед сообщением.
+ * Поэтому даже короткие сообщения с повторяющимися ключами JSON
+ * сжимаются ссылками на словарь.
+ */
+
+namespace SimpleNamedPipe {
+
+    /** \brief Общий словарь сжатия
+     *
+     * Обе стороны канала должны использовать одинаковый словарь, его
+     * идентификатор сравнивается при согласовании возможностей соединения.
+     * Словарь неизменяем и может использоваться из нескольких потоков.
+     */
+    class CompressionDictionary {
+    public:
+        static const size_t max_size = 65535;   /**< Наибольший размер словаря, ограничен смещением совпадения */
+        static const uint32_t hash_bits = 12;   /**< Разрядность хеш-таблицы словаря */
+
+    private:
+        std::string data;
+        std::vector<uint32_t> table;    /**< Позиция + 1 последней четверки байт с данным хешем */
+        uint32_t id = 0;
+
+    public:
+
+        /** \brief Конструктор словаря
+         * \param _data Данные словаря, от более длинных сохраняется конец
+         */
+        explicit CompressionDictionary(const std::string &_data = std::string()) :
+                data(_data.size() > max_size ? _data.substr(_data.size() - max_size) : _data),
+                table((size_t)1 << hash_bits, 0) {
+            // FNV-1a, чтобы стороны могли убедиться, что словари совпадают
+            id = 2166136261u;
+            for (const char c : data) {
+                id ^= static_cast<uint8_t>(c);
+                id *= 16777619u;
+            }
+            // более поздние позиции перезаписывают ранние: смещения до них короче
+            for (size_t i = 0; i + 4 <= data.size(); ++i) {
+                table[get_hash(read32(data.data() + i), hash_bits)] = static_cast<uint32_t>(i + 1);
+            }
+        }
+
+        static inline uint32_t read32(const char *p) noexcept {
+            uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        static inline uint32_t get_hash(const uint32_t value, const uint32_t bits) noexcept {
+            return (value * 2654435761u) >> (32 - bits);
+        }
+
+        inline const char *get_data() const noexcept {return data.data();}
+        inline size_t size() const noexcept {return data.size();}
+        inline uint32_t get_id() const noexcept {return id;}
+
+        /** \brief Найти позицию четверки байт в словаре
+         * \return Позиция + 1 или 0, если четверки нет
+         */
+        inline uint32_t find(const uint32_t hash) const noexcept {
+            return table[hash];
+        }
+
+        /** \brief Обучить словарь на образцах сообщений
+         *
+         * Образцы делятся на отрезки, каждый отрезок оценивается суммой
+         * частот входящих в него 8-байтовых подстрок (частота - число образцов,
+         * где подстрока встречается). Жадно выбираются отрезки с наибольшей
+         * оценкой; подстроки выбранного отрезка больше не учитываются.
+         * Самые ценные отрезки помещаются в конец словаря, ближе к сообщению.
+         * \param samples           Образцы сообщений
+         * \param dictionary_size   Размер словаря
+         * \param segment_size      Размер отрезка
+         * \return Словарь
+         */
+        static CompressionDictionary train(
+                const std::vector<std::string> &samples,
+                const size_t dictionary_size = 16 * 1024,
+                const size_t segment_size = 64) {
+            const size_t dmer_size = sizeof(uint64_t);
+            std::unordered_map<uint64_t, uint32_t> frequency;
+            for (const std::string &sample : samples) {
+                std::unordered_set<uint64_t> seen;
+                for (size_t i = 0; i + dmer_size <= sample.size(); ++i) {
+                    uint64_t dmer;
+                    std::memcpy(&dmer, sample.data() + i, dmer_size);
+                    if (seen.insert(dmer).second) ++frequency[dmer];
+                }
+            }
+
+            const auto get_score = [&](const std::string &sample, const size_t offset, const size_t size) {
+                uint64_t score = 0;
+                for (size_t i = offset; i + dmer_size <= offset + size; ++i) {
+                    uint64_t dmer;
+                    std::memcpy(&dmer, sample.data() + i, dmer_size);
+                    auto it = frequency.find(dmer);
+                    // подстрока из одного образца не повторяется между сообщениями
+                    if (it != frequency.end() && it->second > 1) score += it->second;
+                }
+                return score;
+            };
+
+            /* отрезок: оценка, номер образца, смещение */
+            using segment_t = std::pair<uint64_t, std::pair<size_t, size_t>>;
+            std::priority_queue<segment_t> segments;
+            const size_t step = std::max(segment_size, dmer_size);
+            for (size_t s = 0; s < samples.size(); ++s) {
+                for (size_t offset = 0; offset < samples[s].size(); offset += step) {
+                    const size_t size = std::min(step, samples[s].size() - offset);
+                    const uint64_t score = get_score(samples[s], offset, size);
+                    if (score != 0) segments.push(segment_t(score, std::make_pair(s, offset)));
+                }
+            }
+
+            std::vector<std::string> selected;
+            size_t total_size = 0;
+            const size_t limit = std::min(dictionary_size, static_cast<size_t>(max_size));
+            while (!segments.empty() && total_size < limit) {
+                const segment_t segment = segments.top();
+                segments.pop();
+                const std::string &sample = samples[segment.second.first];
+                const size_t offset = segment.second.second;
+                const size_t size = std::min(std::min(step, sample.size() - offset), limit - total_size);
+                // оценка могла устареть после выбора других отрезков
+                const uint64_t score = get_score(sample, offset, size);
+                if (score == 0) continue;
+                if (!segments.empty() && score < segments.top().first) {
+                    segments.push(segment_t(score, segment.second));
+                    continue;
+                }
+                selected.push_back(sample.substr(offset, size));
+                total_size += size;
+                for (size_t i = offset; i + dmer_size <= offset + size; ++i) {
+                    uint64_t dmer;
+                    std::memcpy(&dmer, sample.data() + i, dmer_size);
+                    frequency.erase(dmer);
+                }
+            }
+
+            std::string data;
+            data.reserve(total_size);
+            for (auto it = selected.rbegin(); it != selected.rend(); ++it) {
+                data += *it;
+            }
+            return CompressionDictionary(data);
+        }
+    };
+
+    /** \brief Сжать данные
+     * \param src           Данные
+     * \param size          Размер данных
+     * \param dictionary    Словарь или nullptr
+     * \param dst           Буфер результата
+     * \param capacity      Размер буфера результата
+     * \param out_size      Размер сжатых данных
+     * \return Вернет false, если сжатые данные не помещаются в буфер
+     */
+    inline bool lz_compress(
+            const char *src,
+            const size_t size,
+            const CompressionDictionary *dictionary,
+            char *dst,
+            const size_t capacity,
+            size_t &out_size) noexcept {
+        const size_t min_match = 4;
+        const size_t max_offset = 65535;
+        const uint32_t max_hash_bits = 12;
+
+        // таблица подстраивается под размер сообщения, чтобы не очищать лишнее
+        uint32_t hash_bits = 8;
+        while (hash_bits < max_hash_bits && ((size_t)1 << hash_bits) < size) ++hash_bits;
+        uint32_t table[(size_t)1 << max_hash_bits];
+        std::fill(table, table + ((size_t)1 << hash_bits), 0);
+
+        const char *dict = dictionary ? dictionary->get_data() : nullptr;
+        const size_t dict_size = dictionary ? dictionary->size() : 0;
+
+        size_t op = 0;
+        const auto write_length = [&](size_t length) -> bool {
+            while (length >= 255) {
+                if (op >= capacity) return false;
+                dst[op++] = static_cast<char>(255);
+                length -= 255;
+            }
+            if (op >= capacity) return false;
+            dst[op++] = static_cast<char>(length);
+            return true;
+        };
+        const auto write_literals = [&](const size_t anchor, const size_t length, const size_t match_code) -> bool {
+            if (op >= capacity) return false;
+            dst[op++] = static_cast<char>(((length < 15 ? length : 15) << 4) | (match_code < 15 ? match_code : 15));
+            if (length >= 15 && !write_length(length - 15)) return false;
+            if (length > capacity - op) return false;
+            std::memcpy(dst + op, src + anchor, length);
+            op += length;
+            return true;
+        };
+
+        size_t anchor = 0;
+        size_t ip = 0;
+        size_t misses = 0;
+        while (size >= min_match && ip + min_match <= size) {
+            const uint32_t value = CompressionDictionary::read32(src + ip);
+            const uint32_t hash = CompressionDictionary::get_hash(value, hash_bits);
+            const uint32_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(ip + 1);
+
+            size_t offset = 0;
+            size_t length = 0;
+            if (candidate != 0 && ip - (candidate - 1) <= max_offset &&
+                CompressionDictionary::read32(src + candidate - 1) == value) {
+                const size_t match = candidate - 1;
+                length = min_match;
+                while (ip + length < size && src[match + length] == src[ip + length]) ++length;
+                offset = ip - match;
+            } else
+            if (dict_size != 0) {
+                const uint32_t position = dictionary->find(
+                    CompressionDictionary::get_hash(value, CompressionDictionary::hash_bits));
+                if (position != 0 && ip + dict_size - (position - 1) <= max_offset &&
+                    CompressionDictionary::read32(dict + position - 1) == value) {
+                    const size_t match = position - 1;
+                    length = min_match;
+                    // совпадение в словаре не переходит в сообщение
+                    while (ip + length < size && match + length < dict_size &&
+                           dict[match + length] == src[ip + length]) ++length;
+                    offset = ip + dict_size - match;
+                }
+            }
+
+            if (length == 0) {
+                // несжимаемые данные проходим все быстрее
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+
+            const size_t match_code = length - min_match;
+            if (!write_literals(anchor, ip - anchor, match_code)) return false;
+            if (capacity - op < 2) return false;
+            dst[op++] = static_cast<char>(offset & 0xFF);
+            dst[op++] = static_cast<char>(offset >> 8);
+            if (match_code >= 15 && !write_length(match_code - 15)) return false;
+
+            ip += length;
+            anchor = ip;
+            if (ip >= 2 && ip + 2 <= size && ip - 2 + min_match <= size) {
+                table[CompressionDictionary::get_hash(CompressionDictionary::read32(src + ip - 2), hash_bits)] =
+                    static_cast<uint32_t>(ip - 2 + 1);
+            }
+        }
+
+        // последняя последовательность состоит только из литералов
+        if (!write_literals(anchor, size - anchor, 0)) return false;
+        out_size = op;
+        return true;
+    }
+
+    /** \brief Распаковать данные
+     * \param src           Сжатые данные
+     * \param size          Размер сжатых данных
+     * \param dictionary    Словарь, которым данные сжаты, или nullptr
+     * \param dst           Буфер результата
+     * \param dst_size      Размер исходных данных
+     * \return Вернет false, если данные повреждены
+     */
+    inline bool lz_decompress(
+            const char *src,
+            const size_t size,
+            const CompressionDictionary *dictionary,
+            char *dst,
+            const size_t dst_size) noexcept {
+        const size_t min_match = 4;
+        const char *dict = dictionary ? dictionary->get_data() : nullptr;
+        const size_t dict_size = dictionary ? dictionary->size() : 0;
+
+        size_t ip = 0;
+        size_t op = 0;
+        const auto read_length = [&](size_t &length) -> bool {
+            uint8_t byte;
+            do {
+                if (ip >= size) return false;
+                byte = static_cast<uint8_t>(src[ip++]);
+                length += byte;
+            } while (byte == 255);
+            return true;
+        };
+
+        while (ip < size) {
+            const uint8_t token = static_cast<uint8_t>(src[ip++]);
+            size_t literals = token >> 4;
+            if (literals == 15 && !read_length(literals)) return false;
+            if (literals > size - ip || literals > dst_size - op) return false;
+            std::memcpy(dst + op, src + ip, literals);
+            ip += literals;
+            op += literals;
+            if (ip == size) break;
+
+            if (size - ip < 2) return false;
+            const size_t offset = static_cast<uint8_t>(src[ip]) | (static_cast<size_t>(static_cast<uint8_t>(src[ip + 1])) << 8);
+            ip += 2;
+            size_t length = token & 0x0F;
+            if (length == 15 && !read_length(length)) return false;
+            length += min_match;
+            if (offset == 0 || offset > op + dict_size || length > dst_size - op) return false;
+
+            if (offset > op) {
+                // начало совпадения в словаре
+                const size_t position = dict_size - (offset - op);
+                const size_t part = std::min(length, dict_size - position);
+                std::memcpy(dst + op, dict + position, part);
+                op += part;
+                length -= part;
+                for (size_t i = 0; i < length; ++i, ++op) dst[op] = dst[op - offset];
+            } else
+            if (offset >= length) {
+                std::memcpy(dst + op, dst + op - offset, length);
+                op += length;
+            } else {
+                // перекрывающееся совпадение копируется побайтно
+                for (size_t i = 0; i < length; ++i, ++op) dst[op] = dst[op - offset];
+            }
+        }
+        return op == dst_size;
+    }
+
+    const size_t COMPRESSED_FRAME_OVERHEAD = sizeof(FrameHeader) + sizeof(uint32_t); /**< Заголовок кадра и исходный размер */
+    const size_t MAX_DECOMPRESSED_SIZE = 64 * 1024 * 1024;  /**< Наибольший размер распакованного сообщения */
+    const size_t MAX_COMPRESSION_RATIO = 255;   /**< Наибольшая степень сжатия блока: байт продолжения длины дает 255 байт совпадения */
+
+    /** \brief Сжать сообщение в кадр FRAME_COMPRESSED
+     *
+     * Данные кадра: исходный размер (uint32_t) и сжатый блок,
+     * id кадра - идентификатор словаря.
+     * \param data          Сообщение
+     * \param size          Размер сообщения
+     * \param dictionary    Словарь
+     * \param frame         Кадр
+     * \return Вернет false, если сжатие не уменьшает сообщение
+     */
+    template<class S>
+    bool make_compressed_frame(
+            const char *data,
+            const size_t size,
+            const CompressionDictionary &dictionary,
+            S &frame) {
+        if (size <= COMPRESSED_FRAME_OVERHEAD || size > MAX_DECOMPRESSED_SIZE) return false;
+        frame.resize(size);
+        size_t compressed_size = 0;
+        if (!lz_compress(data, size, &dictionary, &frame[COMPRESSED_FRAME_OVERHEAD],
+                size - COMPRESSED_FRAME_OVERHEAD - 1, compressed_size)) return false;
+        const uint32_t original_size = static_cast<uint32_t>(size);
+        write_frame_header(FRAME_COMPRESSED, 0, dictionary.get_id(),
+            static_cast<uint32_t>(sizeof(uint32_t) + compressed_size), &frame[0]);
+        std::memcpy(&frame[sizeof(FrameHeader)], &original_size, sizeof(uint32_t));
+        frame.resize(COMPRESSED_FRAME_OVERHEAD + compressed_size);
+        return true;
+    }
+
+    /** \brief Распаковать кадр FRAME_COMPRESSED
+     *
+     * Исходный размер из кадра проверяется до выделения памяти: он не может
+     * превышать сжатый размер больше чем в MAX_COMPRESSION_RATIO раз и max_size,
+     * поэтому короткий кадр не заставит выделить буфер в десятки мегабайт.
+     * \param header        Разобранный заголовок кадра
+     * \param data          Кадр целиком
+     * \param dictionary    Словарь
+     * \param message       Распакованное сообщение
+     * \param max_size      Наибольший размер распакованного сообщения
+     * \return Вернет false, если кадр поврежден или сжат другим словарем
+     */
+    template<class S>
+    bool read_compressed_frame(
+            const FrameHeader &header,
+            const char *data,
+            const CompressionDictionary &dictionary,
+            S &message,
+            const size_t max_size = MAX_DECOMPRESSED_SIZE) {
+        if (header.size < sizeof(uint32_t) || header.id != dictionary.get_id()) return false;
+        uint32_t original_size = 0;
+        std::memcpy(&original_size, data + sizeof(FrameHeader), sizeof(uint32_t));
+        const size_t compressed_size = header.size - sizeof(uint32_t);
+        if (original_size > max_size ||
+            original_size > MAX_DECOMPRESSED_SIZE ||
+            original_size > compressed_size * MAX_COMPRESSION_RATIO) return false;
+        message.resize(original_size);
+        if (original_size == 0) return header.size == sizeof(uint32_t);
+        return lz_decompress(data + COMPRESSED_FRAME_OVERHEAD, header.size - sizeof(uint32_t),
+            &dictionary, &message[0], original_size);
+    }
+}
+
+#endif // SIMPLE_NAMED_PIPE_COMPRESS_HPP_INCLUDED
@@ -0,0 +1,193 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_CRC32C_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_CRC32C_HPP_INCLUDED
+
+#include "named-pipe-frame.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#   define SIMPLE_NAMED_PIPE_CRC32C_SSE42
+#   include <nmmintrin.h>
+#   if defined(_MSC_VER)
+#       include <intrin.h>
+#   else
+#       include <cpuid.h>
+#   endif
+#endif
+
+/** \file
+ * Контрольная сумма CRC32C (полином Castagnoli).
+ *
+ * На процессорах с SSE4.2 сумма считается инструкцией crc32 по 8 байт
+ * за такт, иначе - таблицами slicing-by-8. Наличие SSE4.2 проверяется
+ * один раз при первом вызове.
+ */
+
+namespace SimpleNamedPipe {
+
+    /** \brief Таблицы slicing-by-8 для CRC32C
+     */
+    class Crc32cTable {
+    public:
+        uint32_t data[8][256];
+
+        Crc32cTable() noexcept {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int k = 0; k < 8; ++k) {
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+                }
+                data[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int t = 1; t < 8; ++t) {
+                    data[t][i] = (data[t - 1][i] >> 8) ^ data[0][data[t - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    /** \brief Посчитать CRC32C таблицами slicing-by-8
+     * \param crc   Сумма предыдущих данных или 0
+     * \param data  Данные
+     * \param size  Размер данных
+     * \return Сумма
+     */
+    inline uint32_t crc32c_software(uint32_t crc, const char *data, size_t size) noexcept {
+        static const Crc32cTable table;
+        const uint32_t (*t)[256] = table.data;
+        crc = ~crc;
+        while (size >= 8) {
+            // порядок байт little-endian, как на всех платформах Windows
+            uint32_t low;
+            uint32_t high;
+            std::memcpy(&low, data, sizeof(low));
+            std::memcpy(&high, data + 4, sizeof(high));
+            low ^= crc;
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^
+                  t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^
+                  t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+            data += 8;
+            size -= 8;
+        }
+        for (; size != 0; --size, ++data) {
+            crc = (crc >> 8) ^ t[0][(crc ^ static_cast<uint8_t>(*data)) & 0xFF];
+        }
+        return ~crc;
+    }
+
+#   ifdef SIMPLE_NAMED_PIPE_CRC32C_SSE42
+
+    /** \brief Проверить поддержку SSE4.2
+     */
+    inline bool has_sse42() noexcept {
+#       if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#       else
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+        return (ecx & (1u << 20)) != 0;
+#       endif
+    }
+
+    /** \brief Посчитать CRC32C инструкциями SSE4.2
+     *
+     * Вызывается только после проверки has_sse42().
+     */
+#   if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#   endif
+    inline uint32_t crc32c_hardware(uint32_t crc, const char *data, size_t size) noexcept {
+        crc = ~crc;
+#       if defined(__x86_64__) || defined(_M_X64)
+        uint64_t crc64 = crc;
+        while (size >= 8) {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc64 = _mm_crc32_u64(crc64, value);
+            data += 8;
+            size -= 8;
+        }
+        crc = static_cast<uint32_t>(crc64);
+#       endif
+        while (size >= 4) {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            crc = _mm_crc32_u32(crc, value);
+            data += 4;
+            size -= 4;
+        }
+        for (; size != 0; --size, ++data) {
+            crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+        }
+        return ~crc;
+    }
+
+#   endif
+
+    /** \brief Посчитать CRC32C
+     * \param data  Данные
+     * \param size  Размер данных
+     * \param crc   Сумма предыдущих данных или 0
+     * \return Сумма
+     */
+    inline uint32_t crc32c(const char *data, const size_t size, const uint32_t crc = 0) noexcept {
+#       ifdef SIMPLE_NAMED_PIPE_CRC32C_SSE42
+        static const bool is_sse42 = has_sse42();
+        if (is_sse42) return crc32c_hardware(crc, data, size);
+#       endif
+        return crc32c_software(crc, data, size);
+    }
+
+    /** \brief Собрать кадр FRAME_CHECKED
+     *
+     * Кадр содержит исходное сообщение целиком, id кадра - CRC32C сообщения.
+     * \param data      Сообщение
+     * \param size      Размер сообщения
+     * \param frame     Кадр
+     */
+    template<class S>
+    void make_checked_frame(const char *data, const size_t size, S &frame) {
+        frame.resize(sizeof(FrameHeader) + size);
+        write_frame_header(FRAME_CHECKED, 0, crc32c(data, size), static_cast<uint32_t>(size), &frame[0]);
+        if (size != 0) std::memcpy(&frame[sizeof(FrameHeader)], data, size);
+    }
+
+    /** \brief Проверить контрольную сумму кадра FRAME_CHECKED
+     * \param header    Разобранный заголовок кадра
+     * \param data      Кадр целиком
+     * \return Вернет true, если сумма совпадает
+     */
+    inline bool check_frame(const FrameHeader &header, const char *data) noexcept {
+        return crc32c(data + sizeof(FrameHeader), header.size) == header.id;
+    }
+}
+
+#endif // SIMPLE_NAMED_PIPE_CRC32C_HPP_INCLUDED
@@ -0,0 +1,247 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_DELTA_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_DELTA_HPP_INCLUDED
+
+#include "named-pipe-frame.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/** \file
+ * Разностное кодирование значений ключа.
+ *
+ * Кадр FRAME_DELTA несет ключ (uint16_t длина и байты ключа) и либо полное
+ * значение, либо разность с предыдущим значением этого ключа. id кадра -
+ * версия значения, разность применяется к версии id - 1. Разность - это
+ * новый размер и последовательность правок: пропустить байты старого
+ * значения и записать байты нового. Подходит для сообщений одной структуры,
+ * у которых меняются несколько полей.
+ */
+
+namespace SimpleNamedPipe {
+
+    /** \brief Флаги кадра FRAME_DELTA
+     */
+    enum DeltaFrameFlags {
+        DELTA_FULL = 0,     /**< Полное значение ключа */
+        DELTA_PATCH = 1,    /**< Разность с предыдущей версией значения */
+    };
+
+    const size_t DELTA_MIN_GAP = 4; /**< Совпадающие участки короче не разрывают правку */
+
+    /** \brief Записать число переменной длины (7 бит на байт)
+     */
+    template<class S>
+    inline void write_delta_varint(size_t value, S &out) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    /** \brief Прочитать число переменной длины
+     * \return Вернет false, если данные закончились
+     */
+    inline bool read_delta_varint(const char *&data, const char *end, size_t &value) noexcept {
+        value = 0;
+        for (size_t shift = 0; shift < sizeof(size_t) * 8; shift += 7) {
+            if (data == end) return false;
+            const uint8_t byte = static_cast<uint8_t>(*data++);
+            value |= static_cast<size_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+
+    /** \brief Начать кадр FRAME_DELTA: заголовок и ключ
+     *
+     * Размер данных в заголовке записывается в finish_delta_frame().
+     */
+    template<class S>
+    inline void begin_delta_frame(
+            const uint16_t flags,
+            const uint32_t version,
+            const char *key,
+            const size_t key_size,
+            S &frame) {
+        frame.resize(sizeof(FrameHeader) + sizeof(uint16_t));
+        write_frame_header(FRAME_DELTA, flags, version, 0, &frame[0]);
+        const uint16_t size = static_cast<uint16_t>(key_size);
+        std::memcpy(&frame[sizeof(FrameHeader)], &size, sizeof(uint16_t));
+        frame.append(key, key_size);
+    }
+
+    /** \brief Записать размер данных в заголовок кадра
+     */
+    template<class S>
+    inline void finish_delta_frame(S &frame) {
+        const uint32_t size = static_cast<uint32_t>(frame.size() - sizeof(FrameHeader));
+        std::memcpy(&frame[offsetof(FrameHeader, size)], &size, sizeof(uint32_t));
+    }
+
+    /** \brief Собрать кадр с полным значением ключа
+     * \param version       Версия значения
+     * \param key           Ключ
+     * \param key_size      Размер ключа, не больше 65535
+     * \param value         Значение
+     * \param value_size    Размер значения
+     * \param frame         Кадр
+     */
+    template<class S>
+    void make_delta_full_frame(
+            const uint32_t version,
+            const char *key,
+            const size_t key_size,
+            const char *value,
+            const size_t value_size,
+            S &frame) {
+        begin_delta_frame(DELTA_FULL, version, key, key_size, frame);
+        frame.append(value, value_size);
+        finish_delta_frame(frame);
+    }
+
+    /** \brief Собрать кадр с разностью значений ключа
+     *
+     * Участки, отличающиеся от старого значения, записываются целиком.
+     * Совпадающие участки короче DELTA_MIN_GAP включаются в правку,
+     * чтобы не тратить байты на пропуски.
+     * \param version       Версия нового значения
+     * \param key           Ключ
+     * \param key_size      Размер ключа, не больше 65535
+     * \param old_value     Значение версии version - 1
+     * \param old_size      Размер старого значения
+     * \param value         Новое значение
+     * \param value_size    Размер нового значения
+     * \param frame         Кадр
+     * \return Вернет false, если разность не меньше полного значения
+     */
+    template<class S>
+    bool make_delta_patch_frame(
+            const uint32_t version,
+            const char *key,
+            const size_t key_size,
+            const char *old_value,
+            const size_t old_size,
+            const char *value,
+            const size_t value_size,
+            S &frame) {
+        begin_delta_frame(DELTA_PATCH, version, key, key_size, frame);
+        const size_t limit = frame.size() + value_size;
+        write_delta_varint(value_size, frame);
+
+        const size_t common = old_size < value_size ? old_size : value_size;
+        size_t position = 0;    // конец последней правки
+        size_t i = 0;
+        while (i < value_size) {
+            while (i < common && old_value[i] == value[i]) ++i;
+            if (i == value_size) break;
+            const size_t start = i;
+            size_t end = i;
+            while (end < value_size) {
+                if (end >= common) {
+                    // хвост за пределами старого значения
+                    end = value_size;
+                    break;
+                }
+                if (old_value[end] != value[end]) {
+                    ++end;
+                    continue;
+                }
+                size_t gap = end;
+                while (gap < common && old_value[gap] == value[gap] && (gap - end) < DELTA_MIN_GAP) ++gap;
+                if ((gap - end) >= DELTA_MIN_GAP || gap == value_size) break;
+                end = gap;
+            }
+            write_delta_varint(start - position, frame);
+            write_delta_varint(end - start, frame);
+            frame.append(value + start, end - start);
+            if (frame.size() >= limit) return false;
+            position = end;
+            i = end;
+        }
+        if (frame.size() >= limit) return false;
+        finish_delta_frame(frame);
+        return true;
+    }
+
+    /** \brief Разобрать кадр FRAME_DELTA
+     * \param header        Разобранный заголовок кадра
+     * \param data          Кадр целиком
+     * \param key           Ключ
+     * \param body          Полное значение или разность
+     * \param body_size     Размер значения или разности
+     * \return Вернет false, если кадр поврежден
+     */
+    inline bool parse_delta_frame(
+            const FrameHeader &header,
+            const char *data,
+            std::string &key,
+            const char *&body,
+            size_t &body_size) {
+        if (header.size < sizeof(uint16_t)) return false;
+        uint16_t key_size = 0;
+        std::memcpy(&key_size, data + sizeof(FrameHeader), sizeof(uint16_t));
+        if (header.size - sizeof(uint16_t) < key_size) return false;
+        const char *key_data = data + sizeof(FrameHeader) + sizeof(uint16_t);
+        key.assign(key_data, key_size);
+        body = key_data + key_size;
+        body_size = header.size - sizeof(uint16_t) - key_size;
+        return true;
+    }
+
+    /** \brief Применить разность к значению
+     * \param value         Значение предыдущей версии, заменяется новым
+     * \param body          Разность
+     * \param body_size     Размер разности
+     * \return Вернет false, если разность повреждена, значение при этом не определено
+     */
+    inline bool apply_delta_patch(std::string &value, const char *body, const size_t body_size) {
+        const char *data = body;
+        const char *end = body + body_size;
+        size_t size = 0;
+        if (!read_delta_varint(data, end, size)) return false;
+        // размер не больше размера разности и старого значения вместе
+        if (size > value.size() + body_size) return false;
+        value.resize(size);
+        size_t position = 0;
+        while (data != end) {
+            size_t skip = 0;
+            size_t length = 0;
+            if (!read_delta_varint(data, end, skip) ||
+                !read_delta_varint(data, end, length)) return false;
+            if (skip > size - position) return false;
+            position += skip;
+            if (length > size - position || length > static_cast<size_t>(end - data)) return false;
+            std::memcpy(&value[position], data, length);
+            data += length;
+            position += length;
+        }
+        return true;
+    }
+}
+
+#endif // SIMPLE_NAMED_PIPE_DELTA_HPP_INCLUDED
@@ -0,0 +1,251 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_FRAME_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_FRAME_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace SimpleNamedPipe {
+
+    const uint32_t FRAME_MAGIC = 0x54504E53; /**< Сигнатура кадра, "SNPT" */
+
+    /** \brief Типы кадров
+     */
+    enum FrameKind {
+        FRAME_TYPED = 1,    /**< Двоичное сообщение фиксированной структуры */
+        FRAME_CHANNEL = 2,  /**< Сообщение логического канала, id - номер канала */
+        FRAME_CHUNK = 3,    /**< Часть объемной передачи, id - номер передачи */
+        FRAME_COMPRESSED = 4,   /**< Сжатое сообщение, id - идентификатор словаря */
+        FRAME_HELLO = 5,        /**< Согласование возможностей, id - флаги FeatureFlags */
+        FRAME_CHECKED = 6,      /**< Сообщение с контрольной суммой, id - CRC32C данных */
+        FRAME_DELTA = 7,        /**< Значение ключа или его разность, id - версия значения */
+    };
+
+    /** \brief Возможности соединения, согласуемые кадром FRAME_HELLO
+     */
+    enum FeatureFlags {
+        FEATURE_COMPRESSION = 0x1,  /**< Сжатие сообщений общим словарем */
+        FEATURE_CHECKSUM = 0x2,     /**< Контрольная сумма CRC32C каждого сообщения */
+        FEATURE_DELTA = 0x4,        /**< Разностное кодирование рассылки значений ключей */
+    };
+
+    /** \brief Флаги кадра логического канала
+     */
+    enum ChannelFrameFlags {
+        CHANNEL_DATA = 0,   /**< Данные канала */
+        CHANNEL_OPEN = 1,   /**< Открытие канала */
+        CHANNEL_CLOSE = 2,  /**< Закрытие канала */
+    };
+
+    /** \brief Заголовок кадра двоичного сообщения
+     *
+     * Кадр - это одно сообщение канала: заголовок и сразу за ним данные.
+     * Сообщения без сигнатуры передаются как обычные строки.
+     */
+    struct FrameHeader {
+        uint32_t magic;     /**< Сигнатура кадра */
+        uint16_t kind;      /**< Тип кадра */
+        uint16_t flags;     /**< Флаги кадра */
+        uint32_t id;        /**< Идентификатор типа сообщения */
+        uint32_t size;      /**< Размер данных после заголовка */
+    };
+
+    static_assert(sizeof(FrameHeader) == 16, "FrameHeader must be 16 bytes");
+
+    /** \brief Заголовок части объемной передачи, следует за FrameHeader
+     */
+    struct ChunkHeader {
+        uint64_t offset;    /**< Смещение части от начала передачи */
+        uint64_t total;     /**< Размер всей передачи */
+    };
+
+    static_assert(sizeof(ChunkHeader) == 16, "ChunkHeader must be 16 bytes");
+
+    const size_t CHUNK_FRAME_OVERHEAD = sizeof(FrameHeader) + sizeof(ChunkHeader); /**< Заголовки кадра части */
+
+    /** \brief Данные кадра согласования, следуют за FrameHeader
+     */
+    struct HelloHeader {
+        uint32_t dictionary_id; /**< Идентификатор словаря сжатия */
+        uint32_t reserved;      /**< Зарезервировано */
+    };
+
+    static_assert(sizeof(HelloHeader) == 8, "HelloHeader must be 8 bytes");
+
+    const size_t HELLO_FRAME_SIZE = sizeof(FrameHeader) + sizeof(HelloHeader); /**< Размер кадра согласования */
+
+    /** \brief Идентификатор типа сообщения
+     *
+     * По умолчанию тип не является сообщением. Чтобы объявить структуру
+     * сообщением, используйте макрос SIMPLE_NAMED_PIPE_MESSAGE_TYPE
+     * в глобальной области видимости. Идентификатор должен совпадать
+     * у обеих сторон канала. id объявлен перечислением, поэтому его
+     * можно передавать по ссылке без определения вне класса.
+     */
+    template<class T>
+    struct MessageType {
+        static const bool is_message = false;
+    };
+
+#   define SIMPLE_NAMED_PIPE_MESSAGE_TYPE(TYPE, ID) \
+    namespace SimpleNamedPipe { \
+        template<> \
+        struct MessageType<TYPE> { \
+            static_assert(std::is_trivially_copyable<TYPE>::value, "Message type must be trivially copyable"); \
+            static const bool is_message = true; \
+            enum : uint32_t { id = ID }; \
+        }; \
+    }
+
+    /** \brief Разобрать заголовок кадра
+     * \param data      Данные сообщения
+     * \param size      Размер сообщения
+     * \param header    Заголовок кадра
+     * \return Вернет true, если сообщение является корректным кадром
+     */
+    inline bool parse_frame(const char *data, const size_t size, FrameHeader &header) noexcept {
+        if (size < sizeof(FrameHeader)) return false;
+        std::memcpy(&header, data, sizeof(FrameHeader));
+        if (header.magic != FRAME_MAGIC) return false;
+        return header.size == (size - sizeof(FrameHeader));
+    }
+
+    /** \brief Записать заголовок кадра
+     * \param kind      Тип кадра
+     * \param flags     Флаги кадра
+     * \param id        Идентификатор
+     * \param size      Размер данных после заголовка
+     * \param out       Буфер размером не меньше sizeof(FrameHeader)
+     */
+    inline void write_frame_header(
+            const uint16_t kind,
+            const uint16_t flags,
+            const uint32_t id,
+            const uint32_t size,
+            char *out) noexcept {
+        FrameHeader header;
+        header.magic = FRAME_MAGIC;
+        header.kind = kind;
+        header.flags = flags;
+        header.id = id;
+        header.size = size;
+        std::memcpy(out, &header, sizeof(FrameHeader));
+    }
+
+    /** \brief Записать кадр двоичного сообщения
+     * \param value     Сообщение
+     * \param out       Буфер размером не меньше sizeof(FrameHeader) + sizeof(T)
+     */
+    template<class T>
+    inline void write_typed_frame(const T &value, char *out) noexcept {
+        write_frame_header(FRAME_TYPED, 0, MessageType<T>::id, sizeof(T), out);
+        std::memcpy(out + sizeof(FrameHeader), &value, sizeof(T));
+    }
+
+    /** \brief Записать кадр части объемной передачи
+     * \param transfer  Номер передачи
+     * \param offset    Смещение части
+     * \param total     Размер всей передачи
+     * \param data      Данные части
+     * \param size      Размер части
+     * \param out       Буфер размером не меньше CHUNK_FRAME_OVERHEAD + size
+     */
+    inline void write_chunk_frame(
+            const uint32_t transfer,
+            const uint64_t offset,
+            const uint64_t total,
+            const char *data,
+            const size_t size,
+            char *out) noexcept {
+        write_frame_header(FRAME_CHUNK, 0, transfer, static_cast<uint32_t>(sizeof(ChunkHeader) + size), out);
+        ChunkHeader chunk;
+        chunk.offset = offset;
+        chunk.total = total;
+        std::memcpy(out + sizeof(FrameHeader), &chunk, sizeof(ChunkHeader));
+        if (size != 0) std::memcpy(out + CHUNK_FRAME_OVERHEAD, data, size);
+    }
+
+    /** \brief Записать кадр согласования возможностей
+     * \param features      Флаги FeatureFlags
+     * \param dictionary_id Идентификатор словаря сжатия
+     * \param out           Буфер размером не меньше HELLO_FRAME_SIZE
+     */
+    inline void write_hello_frame(
+            const uint32_t features,
+            const uint32_t dictionary_id,
+            char *out) noexcept {
+        write_frame_header(FRAME_HELLO, 0, features, sizeof(HelloHeader), out);
+        HelloHeader hello;
+        hello.dictionary_id = dictionary_id;
+        hello.reserved = 0;
+        std::memcpy(out + sizeof(FrameHeader), &hello, sizeof(HelloHeader));
+    }
+
+    /** \brief Собрать кадр логического канала
+     * \param channel   Номер канала
+     * \param flags     Флаг из ChannelFrameFlags
+     * \param data      Данные
+     * \param size      Размер данных
+     * \param allocator Аллокатор строки кадра
+     * \return Кадр
+     */
+    template<class S>
+    inline S make_channel_frame(
+            const uint32_t channel,
+            const uint16_t flags,
+            const char *data,
+            const size_t size,
+            const typename S::allocator_type &allocator) {
+        S frame(sizeof(FrameHeader) + size, '\0', allocator);
+        write_frame_header(FRAME_CHANNEL, flags, channel, static_cast<uint32_t>(size), &frame[0]);
+        if (size != 0) std::memcpy(&frame[sizeof(FrameHeader)], data, size);
+        return frame;
+    }
+
+    /** \brief Передать данные кадра обработчику двоичного сообщения
+     *
+     * Данные используются на месте, если они выровнены для типа T,
+     * иначе копируются во временный объект.
+     * \param data      Данные после заголовка
+     * \param size      Размер данных
+     * \param handler   Обработчик вида void(const T&)
+     * \return Вернет false, если размер данных не совпадает с размером T
+     */
+    template<class T, class F>
+    inline bool dispatch_typed_frame(const char *data, const size_t size, const F &handler) {
+        if (size != sizeof(T)) return false;
+        if ((reinterpret_cast<uintptr_t>(data) % alignof(T)) == 0) {
+            handler(*reinterpret_cast<const T*>(data));
+        } else {
+            T value;
+            std::memcpy(&value, data, sizeof(T));
+            handler(value);
+        }
+        return true;
+    }
+}
+
+#endif // SIMPLE_NAMED_PIPE_FRAME_HPP_INCLUDED
@@ -0,0 +1,201 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_INPROC_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_INPROC_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace SimpleNamedPipe {
+
+    const char INPROC_PREFIX[] = "inproc:";     /**< Префикс имени канала внутри процесса */
+
+    /** \brief Ограниченная очередь без блокировок для одного писателя и одного читателя
+     *
+     * Если писателей несколько, запись должна быть сериализована снаружи.
+     */
+    template<class T>
+    class SpscQueue {
+    private:
+        std::vector<T> items;
+        size_t mask = 0;
+        char padding_0[64];
+        std::atomic<size_t> head;   /**< Позиция читателя */
+        char padding_1[64];
+        std::atomic<size_t> tail;   /**< Позиция писателя */
+        char padding_2[64];
+
+    public:
+
+        /** \brief Конструктор очереди
+         * \param capacity Емкость, округляется вверх до степени двойки
+         */
+        explicit SpscQueue(const size_t capacity = 1024) {
+            size_t size = 1;
+            while (size < capacity) size <<= 1;
+            items.resize(size);
+            mask = size - 1;
+            head = 0;
+            tail = 0;
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue &operator=(const SpscQueue&) = delete;
+
+        /** \brief Добавить элемент (писатель)
+         * \param value Элемент, перемещается только при успехе
+         * \return Вернет false, если очередь заполнена
+         */
+        bool push(T &&value) {
+            const size_t position = tail.load(std::memory_order_relaxed);
+            if (position - head.load(std::memory_order_acquire) == items.size()) return false;
+            items[position & mask] = std::move(value);
+            tail.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** \brief Получить первый элемент (читатель)
+         * \return Указатель на элемент или nullptr, если очередь пуста
+         */
+        T *front() noexcept {
+            const size_t position = head.load(std::memory_order_relaxed);
+            if (position == tail.load(std::memory_order_acquire)) return nullptr;
+            return &items[position & mask];
+        }
+
+        /** \brief Удалить первый элемент, полученный через front() (читатель)
+         */
+        void pop() noexcept {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /** \brief Проверить, пуста ли очередь
+         */
+        bool empty() const noexcept {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+    };
+
+    /** \brief Канал внутри процесса
+     *
+     * Пара очередей строк: сообщения перемещаются между клиентом и сервером
+     * без системных вызовов и копирования в буферы канала.
+     */
+    class InprocPipe {
+    public:
+        SpscQueue<std::string> to_server;   /**< Сообщения клиента */
+        SpscQueue<std::string> to_client;   /**< Сообщения сервера */
+        std::atomic<bool> is_server_closed;
+        std::atomic<bool> is_client_closed;
+
+        InprocPipe() {
+            is_server_closed = false;
+            is_client_closed = false;
+        }
+
+        /** \brief Записать сообщение, ожидая место в заполненной очереди
+         *
+         * Как и WriteFile в канал, запись ждет, пока читатель освободит место.
+         * \param queue             Очередь
+         * \param message           Сообщение
+         * \param is_peer_closed    Флаг закрытия читателя
+         * \return Вернет false, если читатель закрыт
+         */
+        static bool push(
+                SpscQueue<std::string> &queue,
+                std::string &&message,
+                const std::atomic<bool> &is_peer_closed) {
+            while (!queue.push(std::move(message))) {
+                if (is_peer_closed) return false;
+                std::this_thread::yield();
+            }
+            return !is_peer_closed;
+        }
+    };
+
+    /** \brief Реестр серверов, доступных внутри процесса
+     */
+    class InprocRegistry {
+    public:
+        using listener_t = std::function<bool(const std::shared_ptr<InprocPipe> &pipe)>;
+
+    private:
+        static std::mutex &get_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::unordered_map<std::string, listener_t> &get_listeners() {
+            static std::unordered_map<std::string, listener_t> listeners;
+            return listeners;
+        }
+
+    public:
+
+        /** \brief Проверить, относится ли имя к каналу внутри процесса
+         */
+        static inline bool is_inproc_name(const std::string &name) noexcept {
+            return name.compare(0, sizeof(INPROC_PREFIX) - 1, INPROC_PREFIX) == 0;
+        }
+
+        /** \brief Зарегистрировать сервер
+         * \param name      Имя канала сервера без префикса
+         * \param listener  Обработчик новых подключений
+         * \return Вернет false, если имя уже занято
+         */
+        static bool listen(const std::string &name, listener_t listener) {
+            std::lock_guard<std::mutex> lock(get_mutex());
+            return get_listeners().emplace(name, std::move(listener)).second;
+        }
+
+        /** \brief Удалить сервер из реестра
+         */
+        static void unlisten(const std::string &name) {
+            std::lock_guard<std::mutex> lock(get_mutex());
+            get_listeners().erase(name);
+        }
+
+        /** \brief Подключиться к серверу
+         * \param name Имя канала сервера без префикса
+         * \return Канал или nullptr, если сервер не запущен
+         */
+        static std::shared_ptr<InprocPipe> connect(const std::string &name) {
+            std::lock_guard<std::mutex> lock(get_mutex());
+            auto it = get_listeners().find(name);
+            if (it == get_listeners().end()) return nullptr;
+            std::shared_ptr<InprocPipe> pipe = std::make_shared<InprocPipe>();
+            if (!it->second(pipe)) return nullptr;
+            return pipe;
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_INPROC_HPP_INCLUDED
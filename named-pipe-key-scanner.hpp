@@ -0,0 +1,211 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_KEY_SCANNER_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_KEY_SCANNER_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define SIMPLE_NAMED_PIPE_SCANNER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define SIMPLE_NAMED_PIPE_SCANNER_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+namespace SimpleNamedPipe {
+
+    /** \brief Поиск значения ключа в JSON-сообщении без полного разбора
+     *
+     * Ищет первое вхождение "key" с последующим двоеточием и возвращает
+     * значение: строку без кавычек или число/литерал.
+     * Поиск кандидатов векторизован (AVX2 или SSE2), для остальных
+     * платформ используется скалярный вариант.
+     */
+    class KeyScanner {
+    private:
+        std::string needle;     /**< Ключ в кавычках */
+
+        static inline unsigned count_trailing_zeros(uint32_t mask) noexcept {
+#           if defined(_MSC_VER)
+            unsigned long index = 0;
+            _BitScanForward(&index, mask);
+            return static_cast<unsigned>(index);
+#           else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#           endif
+        }
+
+        static inline bool is_space(const char c) noexcept {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        /** \brief Разобрать значение после найденного ключа
+         */
+        static bool parse_value(
+                const char *data,
+                const size_t size,
+                size_t pos,
+                const char *&value,
+                size_t &value_size) noexcept {
+            while (pos < size && is_space(data[pos])) ++pos;
+            if (pos >= size || data[pos] != ':') return false;
+            ++pos;
+            while (pos < size && is_space(data[pos])) ++pos;
+            if (pos >= size) return false;
+            if (data[pos] == '"') {
+                const size_t start = ++pos;
+                while (pos < size && data[pos] != '"') {
+                    if (data[pos] == '\\') ++pos;
+                    ++pos;
+                }
+                if (pos >= size) return false;
+                value = data + start;
+                value_size = pos - start;
+                return true;
+            }
+            const size_t start = pos;
+            while (pos < size && data[pos] != ',' && data[pos] != '}' &&
+                   data[pos] != ']' && !is_space(data[pos])) {
+                ++pos;
+            }
+            value = data + start;
+            value_size = pos - start;
+            return value_size != 0;
+        }
+
+        /** \brief Найти позицию ключа в кавычках, начиная с from
+         * \return Позиция или size, если ключ не найден
+         */
+        size_t find_needle(const char *data, const size_t size, size_t from) const noexcept {
+            const size_t n = needle.size();
+            if (size < n) return size;
+            const size_t last = n - 1;
+#           if defined(SIMPLE_NAMED_PIPE_SCANNER_AVX2)
+            const __m256i first_char = _mm256_set1_epi8(needle[1]);
+            const __m256i last_char = _mm256_set1_epi8(needle[last]);
+            const __m256i quote_char = _mm256_set1_epi8('"');
+            while (from + 32 + last <= size) {
+                const __m256i block_quote = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from));
+                const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + 1));
+                const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + last));
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_and_si256(
+                        _mm256_cmpeq_epi8(block_quote, quote_char),
+                        _mm256_cmpeq_epi8(block_first, first_char)),
+                    _mm256_cmpeq_epi8(block_last, last_char))));
+                while (mask != 0) {
+                    const size_t pos = from + count_trailing_zeros(mask);
+                    if (std::memcmp(data + pos, needle.data(), n) == 0) return pos;
+                    mask &= mask - 1;
+                }
+                from += 32;
+            }
+#           elif defined(SIMPLE_NAMED_PIPE_SCANNER_SSE2)
+            const __m128i first_char = _mm_set1_epi8(needle[1]);
+            const __m128i last_char = _mm_set1_epi8(needle[last]);
+            const __m128i quote_char = _mm_set1_epi8('"');
+            while (from + 16 + last <= size) {
+                const __m128i block_quote = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+                const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + 1));
+                const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + last));
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+                    _mm_and_si128(
+                        _mm_cmpeq_epi8(block_quote, quote_char),
+                        _mm_cmpeq_epi8(block_first, first_char)),
+                    _mm_cmpeq_epi8(block_last, last_char))));
+                while (mask != 0) {
+                    const size_t pos = from + count_trailing_zeros(mask);
+                    if (std::memcmp(data + pos, needle.data(), n) == 0) return pos;
+                    mask &= mask - 1;
+                }
+                from += 16;
+            }
+#           endif
+            // хвост сообщения или платформа без SIMD
+            while (from + n <= size) {
+                const void *quote = std::memchr(data + from, '"', size - from - last);
+                if (quote == nullptr) return size;
+                const size_t pos = static_cast<const char*>(quote) - data;
+                if (std::memcmp(data + pos, needle.data(), n) == 0) return pos;
+                from = pos + 1;
+            }
+            return size;
+        }
+
+    public:
+
+        KeyScanner() {};
+
+        /** \brief Конструктор сканера
+         * \param key Имя ключа без кавычек, например "symbol"
+         */
+        explicit KeyScanner(const std::string &key) {
+            set_key(key);
+        }
+
+        /** \brief Установить имя ключа
+         * \param key Имя ключа без кавычек
+         */
+        inline void set_key(const std::string &key) {
+            needle = key.empty() ? std::string() : ("\"" + key + "\"");
+        }
+
+        /** \brief Проверить, задан ли ключ
+         */
+        inline bool empty() const noexcept {
+            return needle.empty();
+        }
+
+        /** \brief Найти значение ключа
+         * \param data          Данные сообщения
+         * \param size          Размер сообщения
+         * \param value         Указатель на начало значения внутри data
+         * \param value_size    Размер значения
+         * \return Вернет true, если ключ со значением найден
+         */
+        bool find(
+                const char *data,
+                const size_t size,
+                const char *&value,
+                size_t &value_size) const noexcept {
+            if (needle.empty()) return false;
+            size_t pos = 0;
+            while (true) {
+                pos = find_needle(data, size, pos);
+                if (pos >= size) return false;
+                if (parse_value(data, size, pos + needle.size(), value, value_size)) return true;
+                ++pos;
+            }
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_KEY_SCANNER_HPP_INCLUDED
@@ -0,0 +1,361 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_MEMORY_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_MEMORY_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#   if __has_include(<memory_resource>)
+#       include <memory_resource>
+#       define SIMPLE_NAMED_PIPE_HAS_PMR
+#   endif
+#endif
+
+namespace SimpleNamedPipe {
+
+#   ifdef SIMPLE_NAMED_PIPE_HAS_PMR
+
+    /** \brief Источник памяти для сообщений и буферов
+     *
+     * В C++17 это std::pmr::memory_resource, поэтому подходят любые
+     * стандартные источники памяти.
+     */
+    using MemoryResource = std::pmr::memory_resource;
+
+    /** \brief Источник памяти по умолчанию (глобальная куча)
+     */
+    inline MemoryResource *get_default_memory_resource() noexcept {
+        return std::pmr::new_delete_resource();
+    }
+
+#   else
+
+    /** \brief Источник памяти для сообщений и буферов
+     *
+     * Интерфейс повторяет std::pmr::memory_resource для компиляторов без C++17.
+     */
+    class MemoryResource {
+    public:
+        virtual ~MemoryResource() {};
+
+        inline void *allocate(const size_t bytes, const size_t alignment = alignof(std::max_align_t)) {
+            return do_allocate(bytes, alignment);
+        }
+
+        inline void deallocate(void *p, const size_t bytes, const size_t alignment = alignof(std::max_align_t)) {
+            do_deallocate(p, bytes, alignment);
+        }
+
+        inline bool is_equal(const MemoryResource &other) const noexcept {
+            return do_is_equal(other);
+        }
+
+    protected:
+        virtual void *do_allocate(size_t bytes, size_t alignment) = 0;
+        virtual void do_deallocate(void *p, size_t bytes, size_t alignment) = 0;
+        virtual bool do_is_equal(const MemoryResource &other) const noexcept = 0;
+    };
+
+    /** \brief Источник памяти на основе операторов new и delete
+     */
+    class NewDeleteMemoryResource : public MemoryResource {
+    protected:
+        void *do_allocate(size_t bytes, size_t) override {
+            return ::operator new(bytes);
+        }
+
+        void do_deallocate(void *p, size_t, size_t) override {
+            ::operator delete(p);
+        }
+
+        bool do_is_equal(const MemoryResource &other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    /** \brief Источник памяти по умолчанию (глобальная куча)
+     */
+    inline MemoryResource *get_default_memory_resource() noexcept {
+        static NewDeleteMemoryResource resource;
+        return &resource;
+    }
+
+#   endif
+
+    /** \brief Аллокатор для контейнеров поверх MemoryResource
+     *
+     * При перемещении и обмене контейнер забирает аллокатор вместе с
+     * памятью, поэтому очередь можно заменить очередью в другом источнике.
+     */
+    template<class T>
+    class ResourceAllocator {
+    public:
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        MemoryResource *resource;
+
+        ResourceAllocator() noexcept : resource(get_default_memory_resource()) {};
+
+        ResourceAllocator(MemoryResource *_resource) noexcept :
+            resource(_resource ? _resource : get_default_memory_resource()) {};
+
+        template<class U>
+        ResourceAllocator(const ResourceAllocator<U> &other) noexcept : resource(other.resource) {};
+
+        T *allocate(const size_t n) {
+            return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *p, const size_t n) noexcept {
+            resource->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        template<class U>
+        struct rebind {
+            using other = ResourceAllocator<U>;
+        };
+    };
+
+    template<class T, class U>
+    inline bool operator==(const ResourceAllocator<T> &a, const ResourceAllocator<U> &b) noexcept {
+        return a.resource == b.resource || a.resource->is_equal(*b.resource);
+    }
+
+    template<class T, class U>
+    inline bool operator!=(const ResourceAllocator<T> &a, const ResourceAllocator<U> &b) noexcept {
+        return !(a == b);
+    }
+
+    using BufferString = std::basic_string<char, std::char_traits<char>, ResourceAllocator<char>>; /**< Сообщение во внутренних очередях */
+    using BufferVector = std::vector<char, ResourceAllocator<char>>;                               /**< Буфер чтения */
+    using BufferDeque = std::deque<BufferString, ResourceAllocator<BufferString>>;                 /**< Хранилище очереди сообщений */
+    using BufferQueue = std::queue<BufferString, BufferDeque>;                                     /**< Очередь сообщений */
+
+    /** \brief Перенести очередь сообщений в другой источник памяти
+     *
+     * Блоки очереди выделяются заново из resource, сообщения перемещаются
+     * без копирования и освобождаются в своем прежнем источнике.
+     * \param queue    Очередь BufferQueue или производная от нее
+     * \param resource Источник памяти
+     */
+    template<class Q>
+    void rebind_queue(Q &queue, MemoryResource *resource) {
+        Q rebound{ResourceAllocator<BufferString>(resource)};
+        for (; !queue.empty(); queue.pop()) rebound.push(std::move(queue.front()));
+        queue = std::move(rebound);
+    }
+
+    /** \brief Подбор размера буфера чтения по распределению размеров сообщений
+     *
+     * Размеры сообщений накапливаются в гистограмме по степеням двойки.
+     * После каждого окна из window_size сообщений рекомендуется размер,
+     * вмещающий 99% сообщений окна. Более редкие крупные сообщения
+     * увеличивают буфер только на время своего окна.
+     */
+    class BufferSizer {
+    private:
+        static const size_t buckets_count = sizeof(size_t) * 8;
+        static const uint32_t window_size = 256;    /**< Сообщений в окне */
+
+        uint32_t histogram[buckets_count];
+        uint32_t samples = 0;
+        size_t min_size = 256;
+        size_t max_size = 64 * 1024;
+
+        static inline size_t get_bucket(const size_t size) noexcept {
+            size_t bucket = 0;
+            while (((size_t)1 << bucket) < size && bucket + 1 < buckets_count) ++bucket;
+            return bucket;
+        }
+
+    public:
+
+        BufferSizer() noexcept {
+            std::fill(histogram, histogram + buckets_count, 0);
+        }
+
+        /** \brief Установить границы размера буфера
+         * \param _min_size Наименьший размер буфера
+         * \param _max_size Наибольший размер буфера
+         */
+        inline void init(const size_t _min_size, const size_t _max_size) noexcept {
+            min_size = _min_size;
+            max_size = std::max(_min_size, _max_size);
+        }
+
+        /** \brief Получить размер буфера для сообщения
+         * \param message_size Размер сообщения
+         * \return Степень двойки не меньше message_size в границах min_size и max_size
+         */
+        inline size_t fit(const size_t message_size) const noexcept {
+            const size_t size = (size_t)1 << get_bucket(message_size);
+            return std::min(std::max(size, min_size), max_size);
+        }
+
+        /** \brief Учесть прочитанное сообщение
+         * \param message_size Размер сообщения
+         * \return Рекомендуемый размер буфера в конце окна, иначе 0
+         */
+        size_t add(const size_t message_size) noexcept {
+            ++histogram[get_bucket(message_size)];
+            if (++samples < window_size) return 0;
+            const uint32_t limit = samples - samples / 100;
+            uint32_t counter = 0;
+            size_t bucket = 0;
+            for (; bucket < buckets_count; ++bucket) {
+                counter += histogram[bucket];
+                if (counter >= limit) break;
+            }
+            std::fill(histogram, histogram + buckets_count, 0);
+            samples = 0;
+            return fit((size_t)1 << bucket);
+        }
+    };
+
+    /** \brief Пул блоков фиксированных размеров для небольших сообщений
+     *
+     * Запросы до max_block_size байт обслуживаются из списков свободных блоков
+     * классов 64, 128, 256 ... байт, которые нарезаются из крупных кусков
+     * вышестоящего источника. Память классов не возвращается до удаления пула.
+     * Более крупные запросы передаются вышестоящему источнику.
+     * Каждый класс размера защищен своим мьютексом.
+     */
+    class PoolMemoryResource : public MemoryResource {
+    private:
+        static const size_t min_block_shift = 6;    /**< Наименьший блок 64 байта */
+        static const size_t classes_count = 11;     /**< Классы до 64 КБ */
+
+        /** \brief Класс размера
+         */
+        class SizeClass {
+        public:
+            std::mutex mutex;
+            void *free_list = nullptr;      /**< Односвязный список свободных блоков */
+            std::vector<void*> chunks;      /**< Куски, полученные от вышестоящего источника */
+        };
+
+        MemoryResource *upstream;
+        size_t chunk_size;
+        SizeClass classes[classes_count];
+
+        static inline size_t get_class_index(const size_t bytes) noexcept {
+            size_t index = 0;
+            size_t size = (size_t)1 << min_block_shift;
+            while (size < bytes) {
+                size <<= 1;
+                ++index;
+            }
+            return index;
+        }
+
+        static inline size_t get_block_size(const size_t index) noexcept {
+            return (size_t)1 << (index + min_block_shift);
+        }
+
+    protected:
+
+        void *do_allocate(size_t bytes, size_t alignment) override {
+            if (bytes > max_block_size() || alignment > alignof(std::max_align_t)) {
+                return upstream->allocate(bytes, alignment);
+            }
+            const size_t index = get_class_index(bytes);
+            SizeClass &size_class = classes[index];
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            if (size_class.free_list == nullptr) {
+                const size_t block_size = get_block_size(index);
+                const size_t size = std::max(chunk_size, block_size);
+                char *chunk = static_cast<char*>(upstream->allocate(size, alignof(std::max_align_t)));
+                size_class.chunks.push_back(chunk);
+                for (size_t offset = 0; offset + block_size <= size; offset += block_size) {
+                    void *block = chunk + offset;
+                    *static_cast<void**>(block) = size_class.free_list;
+                    size_class.free_list = block;
+                }
+            }
+            void *block = size_class.free_list;
+            size_class.free_list = *static_cast<void**>(block);
+            return block;
+        }
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+            if (bytes > max_block_size() || alignment > alignof(std::max_align_t)) {
+                upstream->deallocate(p, bytes, alignment);
+                return;
+            }
+            SizeClass &size_class = classes[get_class_index(bytes)];
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            *static_cast<void**>(p) = size_class.free_list;
+            size_class.free_list = p;
+        }
+
+        bool do_is_equal(const MemoryResource &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+
+        /** \brief Конструктор пула
+         * \param _chunk_size    Размер куска, запрашиваемого у вышестоящего источника
+         * \param _upstream      Вышестоящий источник памяти
+         */
+        explicit PoolMemoryResource(
+                const size_t _chunk_size = 64 * 1024,
+                MemoryResource *_upstream = get_default_memory_resource()) :
+                upstream(_upstream), chunk_size(_chunk_size) {
+        }
+
+        PoolMemoryResource(const PoolMemoryResource&) = delete;
+        PoolMemoryResource &operator=(const PoolMemoryResource&) = delete;
+
+        ~PoolMemoryResource() {
+            for (size_t i = 0; i < classes_count; ++i) {
+                const size_t size = std::max(chunk_size, get_block_size(i));
+                for (void *chunk : classes[i].chunks) {
+                    upstream->deallocate(chunk, size, alignof(std::max_align_t));
+                }
+            }
+        }
+
+        /** \brief Наибольший размер блока, обслуживаемый пулом
+         */
+        static inline size_t max_block_size() noexcept {
+            return get_block_size(classes_count - 1);
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_MEMORY_HPP_INCLUDED
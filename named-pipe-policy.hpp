@@ -0,0 +1,201 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_POLICY_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_POLICY_HPP_INCLUDED
+
+#include "named-pipe-memory.hpp"
+#include <windows.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace SimpleNamedPipe {
+
+    /** \brief Мьютекс без блокировки для однопоточного режима
+     */
+    class NullMutex {
+    public:
+        inline void lock() noexcept {};
+        inline void unlock() noexcept {};
+        inline bool try_lock() noexcept {return true;};
+    };
+
+    /** \brief Условная переменная без ожидания для однопоточного режима
+     *
+     * Ожидание сразу возвращает результат предиката: в однопоточном
+     * режиме некому изменить состояние, пока мы ждем.
+     */
+    class NullCondition {
+    public:
+        inline void notify_one() noexcept {};
+        inline void notify_all() noexcept {};
+
+        template<class Lock, class Rep, class Period, class Predicate>
+        inline bool wait_for(Lock&, const std::chrono::duration<Rep, Period>&, Predicate predicate) {
+            return predicate();
+        }
+    };
+
+    /** \brief Обычная переменная с интерфейсом std::atomic
+     */
+    template<class T>
+    class PlainAtomic {
+    private:
+        T value;
+    public:
+        PlainAtomic() noexcept : value() {};
+        PlainAtomic(const T _value) noexcept : value(_value) {};
+        PlainAtomic(const PlainAtomic&) = delete;
+
+        inline PlainAtomic &operator=(const T _value) noexcept {value = _value; return *this;}
+        inline operator T() const noexcept {return value;}
+        inline T load(std::memory_order = std::memory_order_seq_cst) const noexcept {return value;}
+        inline void store(const T _value, std::memory_order = std::memory_order_seq_cst) noexcept {value = _value;}
+        inline T exchange(const T _value, std::memory_order = std::memory_order_seq_cst) noexcept {
+            const T old = value;
+            value = _value;
+            return old;
+        }
+        inline T operator++() noexcept {return ++value;}
+        inline T operator++(int) noexcept {return value++;}
+        inline T operator+=(const T delta) noexcept {return value += delta;}
+    };
+
+    /** \brief Счетчик, который ничего не считает
+     *
+     * Всегда равен нулю, операции над ним компилятор удаляет.
+     */
+    template<class T>
+    class NullCounter {
+    public:
+        NullCounter() noexcept {};
+        NullCounter(const T) noexcept {};
+        NullCounter(const NullCounter&) = delete;
+
+        inline NullCounter &operator=(const T) noexcept {return *this;}
+        inline operator T() const noexcept {return T();}
+        inline T load(std::memory_order = std::memory_order_seq_cst) const noexcept {return T();}
+        inline T operator++() noexcept {return T();}
+        inline T operator++(int) noexcept {return T();}
+        inline T operator+=(const T) noexcept {return T();}
+    };
+
+    /** \brief Политика блокировок для работы из нескольких потоков (по умолчанию)
+     */
+    class ThreadedLock {
+    public:
+        static const bool is_single_threaded = false;
+        using mutex_type = std::mutex;
+        using condition_type = std::condition_variable;
+        template<class T> using atomic_type = std::atomic<T>;
+    };
+
+    /** \brief Политика блокировок для работы из одного потока
+     *
+     * Мьютексы и атомарные переменные заменяются обычными,
+     * блокировки удаляются компилятором.
+     */
+    class SingleThreadedLock {
+    public:
+        static const bool is_single_threaded = true;
+        using mutex_type = NullMutex;
+        using condition_type = NullCondition;
+        template<class T> using atomic_type = PlainAtomic<T>;
+    };
+
+    /** \brief Ожидание данных на событиях (по умолчанию)
+     *
+     * Поток соединения канала спит, пока не придут данные, не сработает
+     * таймер соединения или не будет остановлен сервер.
+     */
+    class EventWait {
+    public:
+        static const bool is_event_driven = true;   /**< Поток соединения спит до прихода данных */
+
+        /** \brief Подождать перед следующей проверкой канала
+         * \param stop_event    Событие остановки
+         * \param delay_ms      Время ожидания, мс
+         */
+        static inline void wait(HANDLE stop_event, const DWORD delay_ms) noexcept {
+            WaitForSingleObject(stop_event, delay_ms);
+        }
+    };
+
+    /** \brief Ожидание данных без сна: поток только уступает процессор
+     *
+     * Меньше задержка, но ядро занято все время ожидания.
+     */
+    class SpinWait {
+    public:
+        static const bool is_event_driven = false;  /**< Поток соединения опрашивает канал */
+
+        static inline void wait(HANDLE stop_event, const DWORD) noexcept {
+            if (WaitForSingleObject(stop_event, 0) != WAIT_OBJECT_0) std::this_thread::yield();
+        }
+    };
+
+    /** \brief Статистика на атомарных счетчиках (по умолчанию)
+     */
+    class AtomicStats {
+    public:
+        template<class T> using counter_type = std::atomic<T>;
+    };
+
+    /** \brief Статистика на обычных счетчиках для однопоточного режима
+     */
+    class PlainStats {
+    public:
+        template<class T> using counter_type = PlainAtomic<T>;
+    };
+
+    /** \brief Статистика отключена, счетчики всегда равны нулю
+     */
+    class NoStats {
+    public:
+        template<class T> using counter_type = NullCounter<T>;
+    };
+
+    /** \brief Буферы в глобальной куче (по умолчанию)
+     */
+    class DefaultAllocator {
+    public:
+        static inline MemoryResource *get_memory_resource() noexcept {
+            return get_default_memory_resource();
+        }
+    };
+
+    /** \brief Буферы в общем пуле блоков PoolMemoryResource
+     */
+    class PoolAllocator {
+    public:
+        static inline MemoryResource *get_memory_resource() noexcept {
+            static PoolMemoryResource pool;
+            return &pool;
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_POLICY_HPP_INCLUDED
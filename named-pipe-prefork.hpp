@@ -0,0 +1,385 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_PREFORK_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_PREFORK_HPP_INCLUDED
+
+#include "named-pipe-server.hpp"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace SimpleNamedPipe {
+
+    /** \brief Аргумент командной строки рабочего процесса
+     */
+    const char PREFORK_WORKER_ARG[] = "--simple-named-pipe-worker";
+
+    /** \brief Сервер с рабочими процессами
+     *
+     * Процесс-приемщик принимает подключения и передает хендлеры каналов
+     * рабочим процессам через DuplicateHandle. Рабочие процессы - это копии
+     * текущего исполняемого файла, запущенные с аргументом PREFORK_WORKER_ARG,
+     * в которых работает обычный NamedPipeServer с PreforkWorker.
+     * Канал выбирается для процесса с наименьшим количеством соединений.
+     * Упавший процесс перезапускается при следующем подключении, его клиенты
+     * переподключаются, а остальные процессы продолжают работу.
+     * Протокол клиентов не меняется.
+     */
+    class PreforkServer {
+    private:
+
+        /** \brief Рабочий процесс
+         */
+        class Worker {
+        public:
+            HANDLE process = NULL;                      /**< Хендлер процесса */
+            HANDLE control = INVALID_HANDLE_VALUE;      /**< Канал передачи хендлеров */
+        };
+
+        NamedPipeServer acceptor;           /**< Прием подключений */
+        std::vector<Worker> workers;
+        std::mutex workers_mutex;
+
+        HANDLE loads_mapping = NULL;        /**< Общая память со счетчиками соединений процессов */
+        volatile LONG *loads = nullptr;     /**< Счетчики соединений процессов */
+
+        std::string worker_args;            /**< Дополнительные аргументы рабочих процессов */
+        std::atomic<uint64_t> respawned_workers;
+
+        /** \brief Запустить рабочий процесс
+         */
+        bool spawn(const size_t index) {
+            Worker &worker = workers[index];
+            SECURITY_ATTRIBUTES attributes;
+            attributes.nLength = sizeof(attributes);
+            attributes.lpSecurityDescriptor = NULL;
+            attributes.bInheritHandle = TRUE;
+
+            // рабочий процесс наследует только конец канала для чтения
+            HANDLE control_read = INVALID_HANDLE_VALUE;
+            HANDLE control_write = INVALID_HANDLE_VALUE;
+            if (!CreatePipe(&control_read, &control_write, &attributes, 0)) return false;
+            SetHandleInformation(control_write, HANDLE_FLAG_INHERIT, 0);
+
+            char path[1024];
+            const DWORD path_size = GetModuleFileNameA(NULL, path, sizeof(path));
+            if (path_size == 0 || path_size >= sizeof(path)) {
+                CloseHandle(control_read);
+                CloseHandle(control_write);
+                return false;
+            }
+
+            std::string command_line("\"");
+            command_line += std::string(path, path_size);
+            command_line += "\" ";
+            command_line += PREFORK_WORKER_ARG;
+            command_line += " " + std::to_string(index);
+            command_line += " " + std::to_string((uint64_t)(uintptr_t)control_read);
+            command_line += " " + std::to_string((uint64_t)(uintptr_t)loads_mapping);
+            if (!worker_args.empty()) command_line += " " + worker_args;
+
+            STARTUPINFOA startup_info;
+            std::memset(&startup_info, 0, sizeof(startup_info));
+            startup_info.cb = sizeof(startup_info);
+            PROCESS_INFORMATION process_info;
+            std::memset(&process_info, 0, sizeof(process_info));
+
+            const BOOL success = CreateProcessA(
+                NULL,
+                &command_line[0],
+                NULL,
+                NULL,
+                TRUE,           // наследование хендлеров
+                0,
+                NULL,
+                NULL,
+                &startup_info,
+                &process_info);
+            CloseHandle(control_read);
+            if (!success) {
+                CloseHandle(control_write);
+                return false;
+            }
+            CloseHandle(process_info.hThread);
+            worker.process = process_info.hProcess;
+            worker.control = control_write;
+            InterlockedExchange(&loads[index], 0);
+            return true;
+        }
+
+        /** \brief Освободить хендлеры рабочего процесса
+         */
+        void release(Worker &worker) noexcept {
+            if (worker.control != INVALID_HANDLE_VALUE) CloseHandle(worker.control);
+            if (worker.process != NULL) CloseHandle(worker.process);
+            worker.control = INVALID_HANDLE_VALUE;
+            worker.process = NULL;
+        }
+
+        /** \brief Перезапустить завершившиеся рабочие процессы
+         *
+         * Вызывается под workers_mutex.
+         */
+        void respawn() {
+            for (size_t i = 0; i < workers.size(); ++i) {
+                Worker &worker = workers[i];
+                if (worker.process != NULL &&
+                    WaitForSingleObject(worker.process, 0) == WAIT_TIMEOUT) continue;
+                if (worker.process != NULL) {
+                    release(worker);
+                    ++respawned_workers;
+                    if (on_worker_exit) on_worker_exit(i);
+                }
+                spawn(i);
+            }
+        }
+
+        /** \brief Передать принятый канал рабочему процессу
+         * \return Вернет true, если хендлер канала больше не принадлежит приемщику
+         */
+        bool hand_off(const HANDLE pipe) {
+            std::lock_guard<std::mutex> lock(workers_mutex);
+            respawn();
+            // пробуем процессы в порядке возрастания нагрузки
+            std::vector<size_t> order;
+            for (size_t i = 0; i < workers.size(); ++i) {
+                if (workers[i].process != NULL) order.push_back(i);
+            }
+            std::sort(order.begin(), order.end(), [this](const size_t a, const size_t b) {
+                return loads[a] < loads[b];
+            });
+            for (const size_t index : order) {
+                Worker &worker = workers[index];
+                HANDLE remote = NULL;
+                if (!DuplicateHandle(
+                        GetCurrentProcess(), pipe,
+                        worker.process, &remote,
+                        0, FALSE, DUPLICATE_SAME_ACCESS)) continue;
+                const uint64_t value = (uint64_t)(uintptr_t)remote;
+                DWORD bytes_written = 0;
+                if (!WriteFile(worker.control, &value, sizeof(value), &bytes_written, NULL) ||
+                    bytes_written != sizeof(value)) {
+                    // процесс не принимает хендлеры, закрываем копию в нем
+                    DuplicateHandle(worker.process, remote, NULL, NULL, 0, FALSE, DUPLICATE_CLOSE_SOURCE);
+                    continue;
+                }
+                InterlockedIncrement(&loads[index]);
+                CloseHandle(pipe);
+                return true;
+            }
+            // нет живых процессов, клиент переподключится
+            DisconnectNamedPipe(pipe);
+            CloseHandle(pipe);
+            return true;
+        }
+
+        /** \brief Остановить рабочие процессы
+         */
+        void stop_workers() noexcept {
+            std::lock_guard<std::mutex> lock(workers_mutex);
+            // закрытие канала передачи хендлеров завершает рабочий процесс
+            for (auto &worker : workers) {
+                if (worker.control != INVALID_HANDLE_VALUE) CloseHandle(worker.control);
+                worker.control = INVALID_HANDLE_VALUE;
+            }
+            for (auto &worker : workers) {
+                if (worker.process == NULL) continue;
+                if (WaitForSingleObject(worker.process, stop_timeout) != WAIT_OBJECT_0) {
+                    TerminateProcess(worker.process, 1);
+                }
+                release(worker);
+            }
+        }
+
+    public:
+
+        DWORD stop_timeout = 5000;  /**< Время ожидания завершения рабочих процессов, мс */
+
+        std::function<void(size_t index)> on_worker_exit;   /**< Рабочий процесс завершился и будет перезапущен */
+
+        /** \brief Конструктор сервера с рабочими процессами
+         * \param name          Имя именованного канала
+         * \param workers_count Количество рабочих процессов
+         * \param buffer_size   Размер буфера канала
+         * \param timeout       Время ожидания
+         */
+        PreforkServer(
+                const std::string &name,
+                const size_t workers_count,
+                const size_t buffer_size = 2048,
+                const size_t timeout = 0) :
+                acceptor(name, buffer_size, timeout),
+                workers(workers_count == 0 ? 1 : workers_count) {
+            respawned_workers = 0;
+            SECURITY_ATTRIBUTES attributes;
+            attributes.nLength = sizeof(attributes);
+            attributes.lpSecurityDescriptor = NULL;
+            attributes.bInheritHandle = TRUE;
+            loads_mapping = CreateFileMappingA(
+                INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE,
+                0, static_cast<DWORD>(workers.size() * sizeof(LONG)), NULL);
+            if (loads_mapping != NULL) {
+                loads = static_cast<volatile LONG*>(MapViewOfFile(loads_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+            }
+            acceptor.on_accept = [this](HANDLE pipe) {
+                return hand_off(pipe);
+            };
+        }
+
+        PreforkServer(const PreforkServer&) = delete;
+        PreforkServer &operator=(const PreforkServer&) = delete;
+
+        /** \brief Установить дополнительные аргументы командной строки рабочих процессов
+         */
+        inline void set_worker_args(const std::string &args) {
+            std::lock_guard<std::mutex> lock(workers_mutex);
+            worker_args = args;
+        }
+
+        /** \brief Запустить рабочие процессы и прием подключений
+         * \return Вернет true, если все рабочие процессы запущены
+         */
+        bool start() {
+            if (loads == nullptr) return false;
+            {
+                std::lock_guard<std::mutex> lock(workers_mutex);
+                for (size_t i = 0; i < workers.size(); ++i) {
+                    if (workers[i].process != NULL) continue;
+                    if (!spawn(i)) return false;
+                }
+            }
+            return acceptor.start();
+        }
+
+        /** \brief Остановить прием подключений и рабочие процессы
+         */
+        void stop() {
+            acceptor.stop();
+            stop_workers();
+        }
+
+        /** \brief Получить количество соединений рабочего процесса
+         */
+        inline size_t get_worker_connections(const size_t index) const noexcept {
+            if (loads == nullptr || index >= workers.size()) return 0;
+            const LONG value = loads[index];
+            return value > 0 ? static_cast<size_t>(value) : 0;
+        }
+
+        /** \brief Получить количество рабочих процессов
+         */
+        inline size_t get_workers() const noexcept {
+            return workers.size();
+        }
+
+        /** \brief Получить количество перезапусков рабочих процессов
+         */
+        inline uint64_t get_respawned_workers() const noexcept {
+            return respawned_workers;
+        }
+
+        ~PreforkServer() {
+            stop();
+            if (loads != nullptr) UnmapViewOfFile(const_cast<LONG*>(loads));
+            if (loads_mapping != NULL) CloseHandle(loads_mapping);
+        }
+    };
+
+    /** \brief Рабочий процесс сервера
+     *
+     * Получает хендлеры каналов от PreforkServer и добавляет их в обычный
+     * NamedPipeServer, запущенный без приема подключений.
+     */
+    class PreforkWorker {
+    private:
+        size_t index = 0;
+        HANDLE control = INVALID_HANDLE_VALUE;  /**< Канал передачи хендлеров */
+        HANDLE loads_mapping = NULL;
+        volatile LONG *loads = nullptr;
+
+    public:
+
+        /** \brief Проверить, запущен ли процесс как рабочий
+         */
+        static bool is_worker(const int argc, char *argv[]) noexcept {
+            return argc >= 5 && std::strcmp(argv[1], PREFORK_WORKER_ARG) == 0;
+        }
+
+        /** \brief Конструктор рабочего процесса
+         * \param argc Количество аргументов командной строки
+         * \param argv Аргументы командной строки
+         */
+        PreforkWorker(const int argc, char *argv[]) {
+            if (!is_worker(argc, argv)) return;
+            index = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+            control = (HANDLE)(uintptr_t)std::strtoull(argv[3], nullptr, 10);
+            loads_mapping = (HANDLE)(uintptr_t)std::strtoull(argv[4], nullptr, 10);
+            loads = static_cast<volatile LONG*>(MapViewOfFile(loads_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+        }
+
+        PreforkWorker(const PreforkWorker&) = delete;
+        PreforkWorker &operator=(const PreforkWorker&) = delete;
+
+        /** \brief Обслуживать соединения до остановки приемщика
+         *
+         * Запускает server без приема подключений, добавляет полученные
+         * каналы и публикует количество соединений для балансировки.
+         * \param server Сервер с установленными обработчиками
+         * \return Код завершения процесса
+         */
+        int run(NamedPipeServer &server) {
+            if (control == INVALID_HANDLE_VALUE || loads == nullptr) return 1;
+            if (!server.start_worker()) return 1;
+            while (true) {
+                DWORD bytes_to_read = 0;
+                if (!PeekNamedPipe(control, NULL, 0, NULL, &bytes_to_read, NULL)) break;
+                if (bytes_to_read >= sizeof(uint64_t)) {
+                    uint64_t value = 0;
+                    DWORD bytes_read = 0;
+                    if (!ReadFile(control, &value, sizeof(value), &bytes_read, NULL) ||
+                        bytes_read != sizeof(value)) break;
+                    const HANDLE pipe = (HANDLE)(uintptr_t)value;
+                    if (!server.adopt(pipe)) {
+                        DisconnectNamedPipe(pipe);
+                        CloseHandle(pipe);
+                    }
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                InterlockedExchange(&loads[index], static_cast<LONG>(server.get_connections()));
+            }
+            // приемщик остановлен или упал
+            server.stop();
+            return 0;
+        }
+
+        ~PreforkWorker() {
+            if (loads != nullptr) UnmapViewOfFile(const_cast<LONG*>(loads));
+            if (loads_mapping != NULL) CloseHandle(loads_mapping);
+            if (control != INVALID_HANDLE_VALUE) CloseHandle(control);
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_PREFORK_HPP_INCLUDED
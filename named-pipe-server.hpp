@@ -26,6 +26,17 @@
 
 #include <iostream>
 #include <windows.h>
+#include <process.h>
+#include "named-pipe-compress.hpp"
+#include "named-pipe-crc32c.hpp"
+#include "named-pipe-delta.hpp"
+#include "named-pipe-frame.hpp"
+#include "named-pipe-inproc.hpp"
+#include "named-pipe-key-scanner.hpp"
+#include "named-pipe-memory.hpp"
+#include "named-pipe-policy.hpp"
+#include "named-pipe-timing-wheel.hpp"
+#include "named-pipe-trace.hpp"
 
 #include <mutex>
 #include <atomic>
@@ -34,33 +45,99 @@
 #include <system_error>
 #include <thread>
 #include <list>
+#include <deque>
 #include <vector>
+#include <algorithm>
 #include <queue>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 
 namespace SimpleNamedPipe {
 
     /** \brief Класс сервера именованных каналов
+     *
+     * Параметры шаблона задают политики сервера (см. named-pipe-policy.hpp).
+     * \tparam LockPolicy      Блокировки и атомарные флаги: ThreadedLock или SingleThreadedLock
+     * \tparam WaitPolicy      Ожидание данных: EventWait или SpinWait
+     * \tparam StatsPolicy     Счетчики статистики: AtomicStats, PlainStats или NoStats
+     * \tparam AllocatorPolicy Источник памяти по умолчанию: DefaultAllocator или PoolAllocator
      */
-    class NamedPipeServer {
+    template<
+        class LockPolicy = ThreadedLock,
+        class WaitPolicy = EventWait,
+        class StatsPolicy = AtomicStats,
+        class AllocatorPolicy = DefaultAllocator>
+    class BasicNamedPipeServer {
+    private:
+        using mutex_t = typename LockPolicy::mutex_type;
+        using condition_t = typename LockPolicy::condition_type;
+        template<class T> using atomic_t = typename LockPolicy::template atomic_type<T>;
+        template<class T> using counter_t = typename StatsPolicy::template counter_type<T>;
+
+    public:
+
+        /** \brief Приоритет исходящего сообщения
+         */
+        enum class Priority {
+            NORMAL, /**< Обычные и объемные данные */
+            HIGH,   /**< Управляющие сообщения, отправляются раньше обычных */
+        };
+
     private:
         HANDLE pipe = INVALID_HANDLE_VALUE;
         std::future<void>   named_pipe_future;      /**< Поток обработки новых подключений */
         std::future<void>   named_pipe_send_future; /**< Поток обработки исходящих сообщений */
 
-        std::mutex          method_mutex;
+        mutex_t             method_mutex;
+
+        MemoryResource *memory_resource = AllocatorPolicy::get_memory_resource(); /**< Источник памяти для очередей и буферов чтения */
+
+        condition_t              str_queue_check;
+        BufferQueue str_queue{ResourceAllocator<BufferString>(memory_resource)};       /**< Очередь обычных сообщений для всех клиентов */
+        BufferQueue str_queue_high{ResourceAllocator<BufferString>(memory_resource)};  /**< Очередь приоритетных сообщений для всех клиентов */
+        mutex_t                  str_queue_mutex;
+        size_t                  high_burst = 0;     /**< Приоритетных сообщений подряд */
+
+        const size_t max_high_burst = 16;           /**< После стольких приоритетных сообщений подряд отправляется одно обычное */
+
+#       ifdef SIMPLE_NAMED_PIPE_TRACE
+        uint64_t trace_enqueue_seq[2] = {0, 0};     /**< Номера сообщений при постановке в очередь: обычная, приоритетная */
+        uint64_t trace_dequeue_seq[2] = {0, 0};     /**< Номера сообщений при извлечении из очереди */
+        uint64_t trace_broadcast_id = 0;            /**< Идентификатор трассировки последнего извлеченного сообщения */
+#       endif
+
+        atomic_t<bool>   is_reset;                  /**< Команда завершения работы */
+        atomic_t<bool>   is_error;                  /**< Ошибка сервера */
 
-        std::condition_variable str_queue_check;
-        std::queue<std::string> str_queue;
-        std::mutex              str_queue_mutex;
+        HANDLE stop_event = NULL;       /**< Событие остановки, прерывает ожидание во всех потоках сервера */
+        HANDLE connect_event = NULL;    /**< Событие завершения ConnectNamedPipe */
 
-        std::atomic<bool>   is_reset;               /**< Команда завершения работы */
-        std::atomic<bool>   is_error;               /**< Ошибка сервера */
+        bool is_poll = false;           /**< Сервер работает в режиме опроса без собственных потоков */
+        std::string poll_pipename;      /**< Полное имя канала в режиме опроса */
+        OVERLAPPED connect_overlapped;  /**< Ожидание подключения в режиме опроса */
+        bool is_pipe_connected = false; /**< Клиент подключился к экземпляру pipe без ожидания */
 
-        // переменные для разблокировки ConnectNamedPipe
-        std::string connection_pipe_name;
-        std::mutex  connection_pipe_name_mutex;
+        counter_t<uint64_t> accepted_connections;   /**< Всего принятых соединений */
+        counter_t<uint64_t> closed_connections;     /**< Всего удаленных соединений */
+        counter_t<uint64_t> accept_latency_us;      /**< Последнее время простоя между экземплярами канала, мкс */
+        counter_t<uint64_t> max_accept_latency_us;  /**< Максимальное время простоя между экземплярами канала, мкс */
 
-        std::atomic<bool> is_connection;
+        const std::chrono::milliseconds clear_period = std::chrono::milliseconds(100); /**< Период очистки закрытых соединений */
+        const uint64_t timer_tick_ms = 50;          /**< Такт колеса таймеров, мс */
+
+        TimingWheel timers;                         /**< Таймеры heartbeat и простоя, защищены connections_mutex */
+        counter_t<uint64_t> evicted_connections;    /**< Соединений закрыто по тайм-ауту простоя */
+
+        /** \brief Получить время монотонных часов в мс
+         */
+        static inline uint64_t get_time_ms() noexcept {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
 
         /** \brief Класс настроек соединения
          */
@@ -68,166 +145,763 @@ namespace SimpleNamedPipe {
         public:
             std::string name;   /**< Имя именованного канала */
             size_t buffer_size; /**< Размер буфера для чтения и записи */
+            size_t min_buffer_size;     /**< Наименьший размер буфера чтения соединения */
+            size_t max_buffer_size;     /**< Наибольший размер буфера чтения соединения */
             size_t timeout;     /**< Время ожидания */
+            size_t thread_stack_size;   /**< Резерв стека потока соединения */
+            double message_rate;        /**< Лимит входящих сообщений в секунду, 0 - без лимита */
+            double message_burst;       /**< Допустимый всплеск сообщений */
+            double byte_rate;           /**< Лимит входящих байтов в секунду, 0 - без лимита */
+            double byte_burst;          /**< Допустимый всплеск байтов */
+            size_t heartbeat_interval;  /**< Период heartbeat при отсутствии исходящих сообщений, мс, 0 - отключен */
+            std::string heartbeat_message;  /**< Сообщение heartbeat */
+            size_t idle_timeout;        /**< Тайм-аут отсутствия входящих сообщений, мс, 0 - отключен */
 
             Config() :
                 name("server"),
                 buffer_size(2048),
-                timeout(50) {
+                min_buffer_size(256),
+                max_buffer_size(64 * 1024),
+                timeout(50),
+                thread_stack_size(256 * 1024),
+                message_rate(0),
+                message_burst(0),
+                byte_rate(0),
+                byte_burst(0),
+                heartbeat_interval(0),
+                heartbeat_message("{\"heartbeat\":1}"),
+                idle_timeout(0) {
             };
         } config;   /**< Настройки сервера */
 
+        counter_t<uint64_t> throttled_reads;        /**< Сколько раз чтение приостанавливалось лимитом */
+        atomic_t<uint32_t> transfer_counter;        /**< Номер последней объемной передачи */
+
+        std::shared_ptr<const CompressionDictionary> compression;   /**< Словарь сжатия, nullptr - сжатие выключено */
+        size_t min_compress_size = 128;             /**< Сообщения короче не сжимаются */
+        counter_t<uint64_t> compress_input_bytes;   /**< Байт сообщений до сжатия */
+        counter_t<uint64_t> compress_output_bytes;  /**< Байт сжатых кадров */
+        bool is_checksum = false;                   /**< Клиенты могут включить контрольную сумму сообщений */
+        counter_t<uint64_t> checksum_errors;        /**< Входящих сообщений с неверной контрольной суммой */
+
+        /** \brief Последнее разосланное значение ключа
+         */
+        class DeltaState {
+        public:
+            std::string value;
+            uint32_t version = 0;   /**< Версия значения, 0 - значение еще не отправлялось */
+            size_t index = 0;       /**< Номер ключа в версиях соединений */
+            size_t updates = 0;     /**< Обновлений после последнего полного значения */
+        };
+
+        size_t delta_full_interval = 0;             /**< Полное значение ключа отправляется каждые столько обновлений, 0 - разностное кодирование выключено */
+        std::unordered_map<std::string, DeltaState> delta_states;  /**< Значения ключей, используются под connections_mutex */
+        counter_t<uint64_t> delta_input_bytes;      /**< Байт значений ключей для соединений с разностным кодированием */
+        counter_t<uint64_t> delta_output_bytes;     /**< Байт кадров значений и разностей */
+
+        /** \brief Корзина токенов для ограничения скорости
+         */
+        class TokenBucket {
+        private:
+            double rate = 0;        /**< Скорость пополнения, токенов в секунду */
+            double capacity = 0;    /**< Емкость корзины */
+            double tokens = 0;      /**< Доступные токены */
+            std::chrono::steady_clock::time_point last_time;
+
+        public:
+
+            /** \brief Настроить корзину
+             * \param _rate     Скорость пополнения, 0 - без ограничения
+             * \param burst     Емкость корзины, 0 - равна скорости за секунду
+             */
+            void init(const double _rate, const double burst) noexcept {
+                rate = _rate;
+                capacity = burst > 0 ? burst : _rate;
+                tokens = capacity;
+                last_time = std::chrono::steady_clock::now();
+            }
+
+            /** \brief Проверить наличие токенов
+             *
+             * Стоимость больше емкости корзины допускается, когда корзина полна,
+             * иначе такое сообщение нельзя было бы прочитать никогда.
+             * \param cost Стоимость
+             * \param now  Текущее время
+             */
+            bool check(const double cost, const std::chrono::steady_clock::time_point &now) noexcept {
+                if (rate <= 0) return true;
+                const double dt = std::chrono::duration<double>(now - last_time).count();
+                tokens = std::min(capacity, tokens + rate * dt);
+                last_time = now;
+                return tokens >= cost || tokens >= capacity;
+            }
+
+            inline void consume(const double cost) noexcept {
+                if (rate > 0) tokens -= cost;
+            }
+
+            /** \brief Время до появления токенов после неудачной check()
+             * \param cost Стоимость
+             * \return Время, с
+             */
+            inline double get_delay(const double cost) const noexcept {
+                if (rate <= 0) return 0;
+                const double need = std::min(cost, capacity) - tokens;
+                return need > 0 ? need / rate : 0;
+            }
+        };
+
+        /** \brief Состояние соединения, которое читают таймеры и статистика
+         *
+         * Блоки состояний лежат подряд в connection_states, поэтому обход
+         * десятков тысяч простаивающих соединений в таймерах и get_stats()
+         * не затрагивает сами соединения. Блок закрытого соединения
+         * используется повторно следующим соединением.
+         */
+        class ConnectionState {
+        public:
+            atomic_t<uint64_t> last_receive_ms;     /**< Время последнего входящего сообщения */
+            atomic_t<uint64_t> last_send_ms;        /**< Время последнего исходящего сообщения */
+            counter_t<size_t> buffer_capacity;      /**< Размер буфера чтения для статистики */
+            atomic_t<bool> is_heartbeat_due;        /**< Таймер запросил heartbeat, его отправит поток соединения */
+            atomic_t<bool> is_close;                /**< Флаг закрытия соединения */
+            bool is_used = false;                   /**< Блок занят соединением, меняется под connections_mutex */
+            ConnectionState *next_free = nullptr;   /**< Следующий свободный блок */
+        };
+
+        std::deque<ConnectionState> connection_states;  /**< Состояния соединений, адреса блоков не меняются */
+        ConnectionState *free_state = nullptr;          /**< Список свободных блоков */
+
     public:
 
         /** \brief Класс соединения
+         *
+         * Бюджет памяти одного соединения в простое:
+         * объект соединения с узлом списка (около 800 байт, из них 256 байт -
+         * гистограмма размеров сообщений) и блок ConnectionState (40 байт) без
+         * буфера чтения, два события ядра и поток с резервом стека
+         * thread_stack_size, из которого фактически выделяется несколько страниц.
+         * В простое поток спит на событии чтения нуля байт и не просыпается,
+         * пока не придут данные, не сработает таймер или не будет закрыто
+         * соединение. В режиме опроса потока нет.
+         * Буфер чтения выделяется только на время активности соединения
+         * и освобождается после buffer_release_time простоя. Его размер следует
+         * за размерами сообщений: буфер растет под крупное сообщение до
+         * max_buffer_size и уменьшается, когда крупные сообщения перестают приходить.
          */
         class Connection {
         private:
             HANDLE pipe = INVALID_HANDLE_VALUE;     /**< хендлер именованного канала */
-            std::mutex pipe_mutex;
+            mutex_t pipe_mutex;
+
+            HANDLE connection_thread = NULL;        /**< Поток обработки входящих сообщений */
 
-            std::future<void> connection_future;    /**< Поток обработки входящих сообщений */
+            atomic_t<bool> is_reset;                /**< Команда завершения работы */
+            atomic_t<bool> is_error;                /**< Состояние ошибки */
 
-            std::atomic<bool> is_reset;             /**< Команда завершения работы */
-            std::atomic<bool> is_error;             /**< Состояние ошибки */
-            std::atomic<bool> is_close;             /**< Флаг закрытия соединения */
+            BasicNamedPipeServer *server;           /**< Сервер с обработчиками событий */
+            ConnectionState &state;                 /**< Состояние для таймеров и статистики */
 
-            std::function<void(Connection*)> &on_open;
-            std::function<void(Connection*, const std::string &in_message)> &on_message;
-            std::function<void(Connection*)> &on_close;
-            std::function<void(Connection*, const std::error_code &)> &on_error;
+            size_t buffer_size = 2048;              /**< Текущий рекомендуемый размер буфера */
+            BufferVector buffer;                    /**< Буфер чтения, пуст во время простоя */
+            BufferSizer buffer_sizer;               /**< Гистограмма размеров входящих сообщений */
+            std::chrono::steady_clock::time_point last_read;
 
-            size_t buffer_size = 2048;              /**< Размер буфера */
+            TokenBucket message_bucket;             /**< Лимит входящих сообщений */
+            TokenBucket byte_bucket;                /**< Лимит входящих байтов */
+            bool is_throttled = false;              /**< Чтение приостановлено лимитом */
+            std::chrono::steady_clock::time_point throttle_end; /**< Время, когда лимит снова позволит читать */
+
+            /** \brief Узел колеса таймеров соединения
+             */
+            class TimerNode : public TimingWheel::Node {
+            public:
+                Connection *connection = nullptr;
+            } timer_node;
+
+            std::unordered_set<uint32_t> channels;  /**< Открытые логические каналы */
+            mutex_t channels_mutex;
+
+            std::shared_ptr<InprocPipe> inproc;     /**< Канал внутри процесса, вместо pipe */
+            size_t inproc_spins = 0;                /**< Опросов пустой очереди подряд */
+            const size_t max_inproc_spins = 1000;   /**< Опросов без ожидания после сообщения */
+
+            bool is_poll = false;                   /**< Соединение обслуживается в poll_once() без потока */
+            bool is_opened = false;                 /**< Обработчик on_open уже вызван */
+            HANDLE io_event = NULL;                 /**< Событие завершения чтения и записи, используется под pipe_mutex */
+            HANDLE read_event = NULL;               /**< Событие готовности данных, будит поток соединения или цикл событий */
+            OVERLAPPED read_overlapped;             /**< Чтение нуля байт, ожидающее данные */
+            bool is_read_pending = false;           /**< Чтение нуля байт еще не завершено */
+
+            atomic_t<uint32_t> features;            /**< Согласованные возможности FeatureFlags, меняются под pipe_mutex */
+            bool is_checksum_required = false;      /**< Клиент начал добавлять контрольную сумму, сообщения без нее отклоняются */
+            std::vector<uint32_t> delta_versions;   /**< Версии значений ключей у клиента, используются под connections_mutex */
+
+            const uint64_t file_window = 16 * 1024 * 1024; /**< Размер окна отображения файла в send_file */
+
+            friend class BasicNamedPipeServer;
+
+            const std::chrono::milliseconds buffer_release_time = std::chrono::milliseconds(1000); /**< Время простоя до освобождения буфера */
+
+            /** \brief Заменить буфер чтения буфером нового размера без копирования данных
+             */
+            inline void resize_buffer(const size_t size) {
+                BufferVector(size, 0, buffer.get_allocator()).swap(buffer);
+                state.buffer_capacity = size;
+            }
+
+            /** \brief Дождаться завершения перекрывающейся операции
+             *
+             * Канал открыт с FILE_FLAG_OVERLAPPED, поэтому чтение и запись
+             * всегда идут через OVERLAPPED соединения. При остановке сервера
+             * ожидание прерывается и операция отменяется. После возврата
+             * ядро больше не обращается к overlapped.
+             * \param success     Результат ReadFile или WriteFile
+             * \param overlapped  Структура операции
+             * \param bytes       Количество переданных байтов
+             */
+            BOOL complete_io(const BOOL success, OVERLAPPED &overlapped, DWORD &bytes) noexcept {
+                if (!success) {
+                    if (GetLastError() != ERROR_IO_PENDING) return FALSE;
+                    const HANDLE events[2] = {overlapped.hEvent, server->stop_event};
+                    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                        CancelIoEx(pipe, &overlapped);
+                    }
+                }
+                return GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+            }
+
+            /** \brief Подождать новых данных
+             *
+             * Поток соединения канала начинает чтение нуля байт и спит на
+             * read_event до прихода данных, вызова wake() или времени
+             * get_wait_timeout(). Канал внутри процесса и SpinWait опрашивают
+             * канал. Ожидание прерывается сразу при остановке сервера.
+             */
+            void wait_data() noexcept {
+                if (is_poll) return;
+                if (!WaitPolicy::is_event_driven || read_event == NULL) {
+                    WaitPolicy::wait(server->stop_event, 1);
+                    return;
+                }
+                {
+                    std::lock_guard<mutex_t> locker(pipe_mutex);
+                    if (is_throttled) {
+                        // данные уже ждут в канале, просыпаемся по окончании лимита
+                        ResetEvent(read_event);
+                    } else
+                    if (is_read_ready()) {
+                        arm_read();
+                        // чтение завершилось сразу: данные уже пришли или канал закрыт
+                        if (!is_read_pending) return;
+                    } else {
+                        ResetEvent(read_event);
+                        if (is_read_ready()) return;
+                    }
+                }
+                // флаги ставятся до wake(), поэтому сброс события не теряет пробуждение
+                if (is_reset || is_error || state.is_heartbeat_due) return;
+                const HANDLE events[2] = {read_event, server->stop_event};
+                WaitForMultipleObjects(2, events, FALSE, get_wait_timeout());
+            }
+
+            /** \brief Наибольшее время ожидания данных потоком соединения, мс
+             *
+             * Поток просыпается без данных, чтобы освободить буфер простаивающего
+             * соединения или прочитать сообщение после окончания лимита скорости.
+             */
+            DWORD get_wait_timeout() const noexcept {
+                std::chrono::steady_clock::time_point end;
+                if (is_throttled) end = throttle_end;
+                else if (!buffer.empty()) end = last_read + buffer_release_time;
+                else return INFINITE;
+                const auto now = std::chrono::steady_clock::now();
+                if (end <= now) return 0;
+                // округляем вверх, чтобы не проснуться раньше времени
+                return static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    end - now + std::chrono::microseconds(999)).count());
+            }
+
+            /** \brief Разбудить поток соединения
+             *
+             * Вызывается после установки флага, который поток должен обработать.
+             */
+            inline void wake() noexcept {
+                if (!is_poll && read_event != NULL) SetEvent(read_event);
+            }
+
+            /** \brief Проверить лимит скорости перед чтением сообщения
+             *
+             * При превышении лимита не читаем: данные остаются в канале,
+             * и клиент упирается в заполненный буфер канала.
+             * \param size Размер сообщения
+             * \param now  Текущее время
+             * \return Вернет true, если сообщение можно прочитать
+             */
+            bool check_rate_limit(const size_t size, const std::chrono::steady_clock::time_point &now) {
+                const double cost = static_cast<double>(size);
+                const bool is_message_allowed = message_bucket.check(1.0, now);
+                const bool is_byte_allowed = byte_bucket.check(cost, now);
+                if (!is_message_allowed || !is_byte_allowed) {
+                    const double delay = std::max(message_bucket.get_delay(1.0), byte_bucket.get_delay(cost));
+                    throttle_end = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(delay));
+                    if (!is_throttled) {
+                        is_throttled = true;
+                        ++server->throttled_reads;
+                        if (server->on_rate_limit) server->on_rate_limit(this);
+                    }
+                    return false;
+                }
+                is_throttled = false;
+                message_bucket.consume(1.0);
+                byte_bucket.consume(cost);
+                return true;
+            }
+
+            /** \brief Прочитать сообщение канала внутри процесса
+             *
+             * Сообщение перемещается из очереди и передается обработчикам без копирования.
+             * После сообщения соединение некоторое время опрашивает очередь без
+             * ожидания, затем переходит к обычному ожиданию wait_data().
+             */
+            bool read_inproc_message() {
+                std::string *front = inproc->to_server.front();
+                if (front == nullptr) {
+                    if (inproc->is_client_closed) {
+                        is_error = true;
+                    } else
+                    if (inproc_spins < max_inproc_spins) {
+                        ++inproc_spins;
+                        std::this_thread::yield();
+                        return false;
+                    }
+                    wait_data();
+                    return false;
+                }
+                if (!check_rate_limit(front->size(), std::chrono::steady_clock::now())) {
+                    wait_data();
+                    return false;
+                }
+                inproc_spins = 0;
+                const std::string message(std::move(*front));
+                inproc->to_server.pop();
+                state.last_receive_ms = get_time_ms();
+                SIMPLE_NAMED_PIPE_TRACE_ID(trace_id, Trace::get_message_id(TRACE_FLOW_READ));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_READ, trace_id);
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_BEGIN, trace_id);
+                if (!server->is_heartbeat(message.data(), message.size()) &&
+                    !server->dispatch_channel(this, message.data(), message.size()) &&
+                    !server->dispatch_typed(this, message.data(), message.size()) &&
+                    !server->dispatch_route(this, message.data(), message.size())) {
+                    server->on_message(this, message);
+                }
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_END, trace_id);
+                return true;
+            }
 
             /** \brief Прочитать сообщение
+             * \return Вернет true, если сообщение прочитано
              */
-            void read_message() noexcept {
+            bool read_message() {
                 if (is_error) {
-                    std::this_thread::yield();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                    return;
+                    wait_data();
+                    return false;
                 }
+                if (inproc) return read_inproc_message();
 
                 // проверяем наличие данных в кнале
                 DWORD bytes_to_read = 0;
+                DWORD message_size = 0;
                 BOOL success;
                 {
-                    std::unique_lock<std::mutex> locker(pipe_mutex);
-                    success = PeekNamedPipe(pipe, NULL, 0, NULL, &bytes_to_read, NULL);
+                    std::unique_lock<mutex_t> locker(pipe_mutex);
+                    success = PeekNamedPipe(pipe, NULL, 0, NULL, &bytes_to_read, &message_size);
                 }
                 DWORD err = GetLastError();
                 if(!success) {
                     // если соединение закрыто, вернется ERROR_PIPE_NOT_CONNECTED
                     if(err == ERROR_PIPE_NOT_CONNECTED) {
                         is_error = true;
-                        std::this_thread::yield();
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                        return;
+                        wait_data();
+                        return false;
                     } else
                     if(err == ERROR_BROKEN_PIPE) {
                         is_error = true;
-                        std::this_thread::yield();
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                        return;
+                        wait_data();
+                        return false;
                     }
                 }
                 if (bytes_to_read == 0) {
-                    std::this_thread::yield();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                    return;
+                    // освобождаем буфер простаивающего соединения
+                    if (!buffer.empty() &&
+                        (std::chrono::steady_clock::now() - last_read) > buffer_release_time) {
+                        resize_buffer(0);
+                    }
+                    wait_data();
+                    return false;
+                }
+
+                if (message_size == 0) message_size = bytes_to_read;
+                // сообщение больше max_buffer_size читается частично, как и раньше
+                const size_t read_size = std::min((size_t)message_size, buffer_sizer.fit(message_size));
+
+                const auto now = std::chrono::steady_clock::now();
+                if (!check_rate_limit(read_size, now)) {
+                    wait_data();
+                    return false;
                 }
 
-                std::vector<char> buffer(buffer_size);
+                if (buffer.size() < read_size) {
+                    resize_buffer(std::max(buffer_size, buffer_sizer.fit(message_size)));
+                }
+                last_read = now;
                 DWORD bytes_read = 0;
 
                 {
-                    std::unique_lock<std::mutex> locker(pipe_mutex);
+                    std::unique_lock<mutex_t> locker(pipe_mutex);
+                    OVERLAPPED overlapped;
+                    std::memset(&overlapped, 0, sizeof(overlapped));
+                    overlapped.hEvent = io_event;
                     success = ReadFile(
                         pipe,
                         &buffer[0],
-                        std::min((size_t)bytes_to_read, buffer_size),
-                        &bytes_read,
-                        NULL);
+                        read_size,
+                        NULL,
+                        &overlapped);
+                    success = complete_io(success, overlapped, bytes_read);
+                    err = GetLastError();
                 }
 
-                err = GetLastError();
-
                 if(!success || bytes_read == 0) {
                     if(err == ERROR_BROKEN_PIPE) {
                         is_error = true;
-                        std::this_thread::yield();
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                        return;
+                        wait_data();
+                        return false;
                     } else {
-                        if(on_error != nullptr) {
-                            on_error(this,std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
+                        if(server->on_error != nullptr) {
+                            server->on_error(this,std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
                         }
                     }
                     is_error = true;
                 }
-                on_message(this, std::string(buffer.begin(),buffer.begin() + bytes_read));
+                if (bytes_read != 0) {
+                    state.last_receive_ms = get_time_ms();
+                    // в конце окна гистограммы уменьшаем буфер, если крупные сообщения не приходили
+                    const size_t size = buffer_sizer.add(bytes_read);
+                    if (size != 0) {
+                        buffer_size = size;
+                        if (buffer.size() > size) resize_buffer(size);
+                    }
+                }
+                SIMPLE_NAMED_PIPE_TRACE_ID(trace_id, Trace::get_message_id(TRACE_FLOW_READ));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_READ, trace_id);
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_BEGIN, trace_id);
+                server->dispatch_message(this, &buffer[0], bytes_read);
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DISPATCH_END, trace_id);
+                return true;
+            }
+
+            /** \brief Отправить heartbeat, если его запросил таймер
+             *
+             * Вызывается в потоке соединения, поэтому медленный клиент
+             * задерживает только свое соединение, а не поток рассылки.
+             */
+            inline void send_heartbeat() noexcept {
+                if (state.is_heartbeat_due.exchange(false)) send(server->config.heartbeat_message);
+            }
+
+            /** \brief Обработать соединение в отдельном потоке
+             *
+             * Исключение обработчика теряет одно сообщение, но не прерывает
+             * соединение: on_close и освобождение канала выполняются всегда.
+             */
+            void run() noexcept {
+                try {
+                    server->on_open(this);
+                }
+                catch(...) {}
+                while (!is_reset && !is_error) {
+                    try {
+                        send_heartbeat();
+                        read_message();
+                    }
+                    catch(...) {}
+                }
+                notify_close();
+                release();
+            }
+
+            /** \brief Закрыть логические каналы и вызвать on_close
+             */
+            void notify_close() noexcept {
+                try {
+                    close_channels();
+                }
+                catch(...) {}
+                try {
+                    server->on_close(this);
+                }
+                catch(...) {}
+            }
+
+            /** \brief Закрыть канал и освободить буфер завершенного соединения
+             */
+            void release() noexcept {
+                // очищаем буфер только когда соединение было закрыто не сбросом
+                std::lock_guard<mutex_t> locker(pipe_mutex);
+                if(pipe != INVALID_HANDLE_VALUE) {
+                    if (is_read_pending) {
+                        CancelIoEx(pipe, &read_overlapped);
+                        DWORD bytes = 0;
+                        GetOverlappedResult(pipe, &read_overlapped, &bytes, TRUE);
+                        is_read_pending = false;
+                    }
+                    if (!is_reset) FlushFileBuffers(pipe);
+                    DisconnectNamedPipe(pipe);
+                    CloseHandle(pipe);
+                    pipe = INVALID_HANDLE_VALUE;
+                }
+                resize_buffer(0);
+                if (inproc) inproc->is_server_closed = true;
+                state.is_close = true;
+            }
+
+            /** \brief Проверить, завершилось ли ожидание данных
+             */
+            bool is_read_ready() noexcept {
+                if (!is_read_pending) return true;
+                DWORD bytes = 0;
+                if (!GetOverlappedResult(pipe, &read_overlapped, &bytes, FALSE) &&
+                    GetLastError() == ERROR_IO_INCOMPLETE) return false;
+                is_read_pending = false;
+                return true;
+            }
+
+            /** \brief Начать ожидание данных чтением нуля байт
+             *
+             * В режиме сообщений такое чтение завершается с приходом сообщения,
+             * не извлекая его из канала, и переводит read_event в сигнальное состояние.
+             */
+            void arm_read() noexcept {
+                if (is_read_pending || pipe == INVALID_HANDLE_VALUE) return;
+                std::memset(&read_overlapped, 0, sizeof(read_overlapped));
+                read_overlapped.hEvent = read_event;
+                ResetEvent(read_event);
+                char dummy = 0;
+                if (!ReadFile(pipe, &dummy, 0, NULL, &read_overlapped) &&
+                    GetLastError() == ERROR_IO_PENDING) {
+                    is_read_pending = true;
+                }
+            }
+
+            /** \brief Обработать соединение в режиме опроса
+             *
+             * Читает готовые сообщения без ожидания, затем снова начинает
+             * ожидание данных. Закрытое соединение вызывает on_close и
+             * освобождает канал.
+             * \param max_messages Наибольшее количество сообщений
+             * \return Количество прочитанных сообщений
+             */
+            size_t poll(const size_t max_messages) noexcept {
+                if (state.is_close) return 0;
+                size_t counter = 0;
+                if (!is_opened) {
+                    is_opened = true;
+                    try {
+                        server->on_open(this);
+                    }
+                    catch(...) {}
+                }
+                while (counter < max_messages && !is_reset && !is_error && is_read_ready()) {
+                    // исключение обработчика теряет одно сообщение, но не соединение
+                    try {
+                        if (!read_message()) break;
+                    }
+                    catch(...) {}
+                    ++counter;
+                }
+                if (!is_reset && !is_error) {
+                    std::lock_guard<mutex_t> locker(pipe_mutex);
+                    // при лимите данные уже ждут в канале, и чтение нуля байт
+                    // завершилось бы сразу: цикл проснется по get_poll_timeout()
+                    if (is_throttled) {
+                        ResetEvent(read_event);
+                    } else {
+                        arm_read();
+                    }
+                    return counter;
+                }
+                notify_close();
+                release();
+                return counter;
+            }
+
+            /** \brief Закрыть все логические каналы при закрытии соединения
+             */
+            void close_channels() {
+                std::unordered_set<uint32_t> closed;
+                {
+                    std::lock_guard<mutex_t> locker(channels_mutex);
+                    closed.swap(channels);
+                }
+                if (!server->on_channel_close) return;
+                for (const uint32_t channel : closed) {
+                    server->on_channel_close(this, channel);
+                }
+            }
+
+            static unsigned __stdcall thread_proc(void *arg) {
+                static_cast<Connection*>(arg)->run();
+                return 0;
             }
 
         public:
 
+            /** \brief Конструктор соединения
+             * \param _pipe              Хендлер подключенного канала
+             * \param _server            Сервер с обработчиками событий
+             * \param _state             Блок состояния соединения
+             * \param _buffer_size       Начальный размер буфера
+             * \param _thread_stack_size Резерв стека потока соединения
+             * \param _inproc            Канал внутри процесса, если _pipe не задан
+             */
             Connection(
                     const HANDLE _pipe,
-                    std::function<void(Connection*)> &_on_open,
-                    std::function<void(Connection*, const std::string &in_message)> &_on_message,
-                    std::function<void(Connection*)> &_on_close,
-                    std::function<void(Connection*, const std::error_code &)> &_on_error,
-                    const size_t _buffer_size) :
+                    BasicNamedPipeServer *_server,
+                    ConnectionState &_state,
+                    const size_t _buffer_size,
+                    const size_t _thread_stack_size,
+                    const std::shared_ptr<InprocPipe> &_inproc = nullptr) :
                         pipe(_pipe),
-                        on_open(_on_open),
-                        on_message(_on_message),
-                        on_close(_on_close),
-                        on_error(_on_error),
-                        buffer_size(_buffer_size) {
+                        server(_server),
+                        state(_state),
+                        buffer_size(_buffer_size),
+                        buffer(ResourceAllocator<char>(_server->memory_resource)),
+                        inproc(_inproc) {
 
+                is_poll = server->is_poll;
                 is_reset = false;
                 is_error = false;
-                is_close = false;
-
-                connection_future = std::async(std::launch::async,[this]() {
-                    on_open(this);
-                    while (!is_reset && !is_error) {
-                        read_message();
+                state.is_close = false;
+                state.is_heartbeat_due = false;
+                features = 0;
+                state.buffer_capacity = 0;
+                buffer_sizer.init(
+                    std::min(server->config.min_buffer_size, _buffer_size),
+                    std::max(server->config.max_buffer_size, _buffer_size));
+
+                timer_node.connection = this;
+                state.last_receive_ms = get_time_ms();
+                state.last_send_ms = static_cast<uint64_t>(state.last_receive_ms);
+
+                message_bucket.init(server->config.message_rate, server->config.message_burst);
+                byte_bucket.init(server->config.byte_rate, server->config.byte_burst);
+
+                // без событий завершения операций канал нельзя ни читать, ни писать
+                bool is_io = true;
+                if (pipe != INVALID_HANDLE_VALUE) {
+                    io_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+                    if (is_poll || WaitPolicy::is_event_driven) {
+                        // в режиме опроса событие создается в сигнальном состоянии,
+                        // чтобы первый poll_once() вызвал on_open
+                        read_event = CreateEvent(NULL, TRUE, is_poll ? TRUE : FALSE, NULL);
+                        is_io = read_event != NULL;
                     }
-                    on_close(this);
-                    // очищаем буфер только когда соединение было закрыто не сбросом
-                    {
-                        std::lock_guard<std::mutex> locker(pipe_mutex);
-                        if(pipe != INVALID_HANDLE_VALUE) {
-                            if (!is_reset) FlushFileBuffers(pipe);
-                            DisconnectNamedPipe(pipe);
-                            CloseHandle(pipe);
-                            pipe = INVALID_HANDLE_VALUE;
-                        }
-                        is_close = true;
+                    is_io = is_io && io_event != NULL;
+                }
+
+                if (is_io && !is_poll) {
+                    // стек задается как резерв, физическая память выделяется по мере использования
+                    connection_thread = (HANDLE)_beginthreadex(
+                        NULL,
+                        static_cast<unsigned>(_thread_stack_size),
+                        &Connection::thread_proc,
+                        this,
+                        STACK_SIZE_PARAM_IS_A_RESERVATION,
+                        NULL);
+                }
+
+                if (!is_io || (!is_poll && connection_thread == NULL)) {
+                    is_error = true;
+                    if (pipe != INVALID_HANDLE_VALUE) {
+                        DisconnectNamedPipe(pipe);
+                        CloseHandle(pipe);
+                        pipe = INVALID_HANDLE_VALUE;
                     }
-                });
+                    if (inproc) inproc->is_server_closed = true;
+                    state.is_close = true;
+                }
             }
 
             ~Connection() {
                 close();
-                std::shared_future<void> connection_share = connection_future.share();
-                if(connection_share.valid()) {
+                if (connection_thread != NULL) {
+                    WaitForSingleObject(connection_thread, INFINITE);
+                    CloseHandle(connection_thread);
+                }
+                if (read_event != NULL) {
+                    release();
+                    CloseHandle(read_event);
+                }
+                if (io_event != NULL) CloseHandle(io_event);
+            }
+
+        private:
+
+            /** \brief Записать сообщение, добавив контрольную сумму, если соединение ее согласовало
+             * \param data      Данные сообщения
+             * \param size      Размер сообщения
+             * \param callback  Обратный вызов для ошибки
+             */
+            inline void write(
+                    const char *data,
+                    const size_t size,
+                    const std::function<void(const std::error_code &ec)> &callback) noexcept {
+                std::unique_lock<mutex_t> locker(pipe_mutex);
+                write_locked(locker, data, size, callback);
+            }
+
+            /** \brief Записать сообщение под pipe_mutex, добавив контрольную сумму
+             *
+             * Возможности соединения проверяются под тем же pipe_mutex, под
+             * которым dispatch_hello() их меняет: после ответа на согласование
+             * все сообщения уходят с контрольной суммой.
+             * \param locker    Захваченный pipe_mutex
+             * \param data      Данные сообщения
+             * \param size      Размер сообщения
+             * \param callback  Обратный вызов для ошибки
+             */
+            void write_locked(
+                    std::unique_lock<mutex_t> &locker,
+                    const char *data,
+                    const size_t size,
+                    const std::function<void(const std::error_code &ec)> &callback) noexcept {
+                if (features & FEATURE_CHECKSUM) {
                     try {
-                        connection_share.wait();
-                        connection_share.get();
+                        BufferString frame{ResourceAllocator<char>(server->memory_resource)};
+                        make_checked_frame(data, size, frame);
+                        write_pipe(locker, frame.data(), frame.size(), callback);
                     }
-                    catch(...) {}
+                    catch(...) {
+                        is_error = true;
+                    }
+                    return;
                 }
+                write_pipe(locker, data, size, callback);
             }
 
-            /** \brief Отправить сообщение
-             * \param out_message Сообщение
-             * \param callback Обратный вызов для ошибки
+            /** \brief Записать данные в канал без преобразований
+             * \param locker    Захваченный pipe_mutex, отпускается на время обратных вызовов
+             * \param data      Данные сообщения
+             * \param size      Размер сообщения
+             * \param callback  Обратный вызов для ошибки
              */
-            void send(
-                    const std::string &out_message,
-                    const std::function<void(const std::error_code &ec)> &callback = nullptr) noexcept {
-                std::unique_lock<std::mutex> locker(pipe_mutex);
+            void write_pipe(
+                    std::unique_lock<mutex_t> &locker,
+                    const char *data,
+                    const size_t size,
+                    const std::function<void(const std::error_code &ec)> &callback) noexcept {
                 if (is_reset) return;
 
                 try {
@@ -239,123 +913,848 @@ namespace SimpleNamedPipe {
                         }
                         return;
                     }
+                    if (inproc) {
+                        // сообщение копируется один раз прямо в очередь клиента
+                        if (InprocPipe::push(inproc->to_client, std::string(data, size), inproc->is_client_closed)) {
+                            state.last_send_ms = get_time_ms();
+                            return;
+                        }
+                        locker.unlock();
+                        const std::error_code ec(static_cast<int>(ERROR_BROKEN_PIPE), std::generic_category());
+                        if (callback) callback(ec);
+                        if (server->on_error) server->on_error(this, ec);
+                        locker.lock();
+                        is_error = true;
+                        return;
+                    }
                     if(pipe == INVALID_HANDLE_VALUE) return;
                     DWORD bytes_written = 0;
 
+                    SIMPLE_NAMED_PIPE_TRACE_ID(trace_id, Trace::get_message_id(TRACE_FLOW_SERVER_SEND));
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_BEGIN, trace_id);
+                    OVERLAPPED overlapped;
+                    std::memset(&overlapped, 0, sizeof(overlapped));
+                    overlapped.hEvent = io_event;
                     BOOL success = WriteFile(
                         pipe,
-                        out_message.c_str(),    // буфер для записи
-                        out_message.size(),     // количество байтов для записи
-                        &bytes_written,         // количество записанных байтов
-                        NULL);                  // не перекрывается I/O
-
-                    if (!success || out_message.size() != bytes_written) {
+                        data,                   // буфер для записи
+                        size,                   // количество байтов для записи
+                        NULL,                   // количество записанных байтов вернет complete_io
+                        &overlapped);
+                    success = complete_io(success, overlapped, bytes_written);
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_END, trace_id);
+
+                    if (success) state.last_send_ms = get_time_ms();
+                    if (!success || size != bytes_written) {
                         // ошибка записи, закрываем соединение
                         locker.unlock();
                         if (callback) {
                             callback(std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
                         }
-                        if (on_error) {
-                            on_error(this,std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
+                        if (server->on_error) {
+                            server->on_error(this,std::error_code(static_cast<int>(GetLastError()), std::generic_category()));
                         }
                         locker.lock();
                         CancelIo(pipe);
                         is_error = true;
                     }
                 }
-                catch(...) {
-                    is_error = true;
+                catch(...) {
+                    is_error = true;
+                }
+            }
+
+            /** \brief Записать сообщение, сжав его, если соединение согласовало сжатие
+             * \param data      Сообщение
+             * \param size      Размер сообщения
+             * \param callback  Обратный вызов для ошибки
+             */
+            void write_message(
+                    const char *data,
+                    const size_t size,
+                    const std::function<void(const std::error_code &ec)> &callback) noexcept {
+                if ((features & FEATURE_COMPRESSION) && size >= server->min_compress_size) {
+                    try {
+                        BufferString frame{ResourceAllocator<char>(server->memory_resource)};
+                        if (make_compressed_frame(data, size, *server->compression, frame)) {
+                            server->compress_input_bytes += size;
+                            server->compress_output_bytes += frame.size();
+                            write(frame.data(), frame.size(), callback);
+                            return;
+                        }
+                    }
+                    catch(...) {}
+                }
+                write(data, size, callback);
+            }
+
+            /** \brief Записать область памяти кадрами частей
+             * \param transfer      Номер передачи
+             * \param offset        Смещение области от начала передачи
+             * \param total         Размер всей передачи
+             * \param data          Данные области
+             * \param size          Размер области
+             * \param frame         Буфер кадра размером не меньше CHUNK_FRAME_OVERHEAD + chunk_size
+             * \param chunk_size    Наибольший размер данных части
+             * \param on_progress   Обратный вызов после каждой части
+             * \return Вернет false при ошибке записи или закрытии соединения
+             */
+            bool write_region(
+                    const uint32_t transfer,
+                    const uint64_t offset,
+                    const uint64_t total,
+                    const char *data,
+                    const size_t size,
+                    BufferVector &frame,
+                    const size_t chunk_size,
+                    const std::function<void(uint64_t sent, uint64_t total)> &on_progress) {
+                size_t position = 0;
+                do {
+                    const size_t part = std::min(chunk_size, size - position);
+                    write_chunk_frame(transfer, offset + position, total, data + position, part, &frame[0]);
+                    write(&frame[0], CHUNK_FRAME_OVERHEAD + part, nullptr);
+                    if (is_error || is_reset) return false;
+                    position += part;
+                    if (on_progress) on_progress(offset + position, total);
+                } while (position < size);
+                return true;
+            }
+
+        public:
+
+            /** \brief Отправить область памяти объемной передачей
+             *
+             * Данные отправляются кадрами частей размером до chunk_size, которые
+             * клиент получает в on_chunk. Между частями соединение может отправлять
+             * другие сообщения. Буфер кадра берется из источника памяти сервера.
+             * \param data          Данные
+             * \param size          Размер данных
+             * \param on_progress   Обратный вызов после каждой части: отправлено и всего байт
+             * \param chunk_size    Размер части, вместе с заголовками должен помещаться в буфер клиента
+             * \return Вернет true, если передача отправлена целиком
+             */
+            bool send_region(
+                    const char *data,
+                    const size_t size,
+                    const std::function<void(uint64_t sent, uint64_t total)> &on_progress = nullptr,
+                    const size_t chunk_size = 32 * 1024) noexcept {
+                if (chunk_size == 0) return false;
+                const uint32_t transfer = ++server->transfer_counter;
+                try {
+                    BufferVector frame(
+                        CHUNK_FRAME_OVERHEAD + std::min(chunk_size, size), 0,
+                        ResourceAllocator<char>(server->memory_resource));
+                    return write_region(transfer, 0, size, data, size, frame, chunk_size, on_progress);
+                }
+                catch(...) {
+                    return false;
+                }
+            }
+
+            /** \brief Отправить файл объемной передачей
+             *
+             * Файл не читается в память целиком: он отображается окнами
+             * по file_window байт, и каждая часть копируется из отображения
+             * прямо в буфер кадра.
+             * \param path          Путь к файлу
+             * \param offset        Смещение от начала файла
+             * \param length        Длина, 0 - до конца файла
+             * \param on_progress   Обратный вызов после каждой части: отправлено и всего байт
+             * \param chunk_size    Размер части, вместе с заголовками должен помещаться в буфер клиента
+             * \return Вернет true, если передача отправлена целиком
+             */
+            bool send_file(
+                    const std::string &path,
+                    const uint64_t offset = 0,
+                    const uint64_t length = 0,
+                    const std::function<void(uint64_t sent, uint64_t total)> &on_progress = nullptr,
+                    const size_t chunk_size = 32 * 1024) noexcept {
+                if (chunk_size == 0) return false;
+                const HANDLE file = CreateFileA(
+                    path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file == INVALID_HANDLE_VALUE) return false;
+
+                bool is_sent = false;
+                HANDLE mapping = NULL;
+                try {
+                    LARGE_INTEGER file_size;
+                    if (!GetFileSizeEx(file, &file_size) ||
+                        offset > static_cast<uint64_t>(file_size.QuadPart)) {
+                        CloseHandle(file);
+                        return false;
+                    }
+                    const uint64_t available = static_cast<uint64_t>(file_size.QuadPart) - offset;
+                    const uint64_t total = (length == 0) ? available : std::min(length, available);
+                    const uint32_t transfer = ++server->transfer_counter;
+                    BufferVector frame(
+                        CHUNK_FRAME_OVERHEAD + static_cast<size_t>(std::min<uint64_t>(chunk_size, total)), 0,
+                        ResourceAllocator<char>(server->memory_resource));
+
+                    if (total == 0) {
+                        is_sent = write_region(transfer, 0, 0, nullptr, 0, frame, chunk_size, on_progress);
+                    } else {
+                        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                        if (mapping != NULL) {
+                            SYSTEM_INFO system_info;
+                            GetSystemInfo(&system_info);
+                            const uint64_t granularity = system_info.dwAllocationGranularity;
+                            uint64_t position = 0;
+                            is_sent = true;
+                            while (position < total) {
+                                // начало окна выравнивается по гранулярности отображения
+                                const uint64_t file_position = offset + position;
+                                const uint64_t view_start = file_position - file_position % granularity;
+                                const size_t delta = static_cast<size_t>(file_position - view_start);
+                                const size_t part = static_cast<size_t>(std::min<uint64_t>(file_window, total - position));
+                                const char *view = static_cast<const char*>(MapViewOfFile(
+                                    mapping, FILE_MAP_READ,
+                                    static_cast<DWORD>(view_start >> 32),
+                                    static_cast<DWORD>(view_start & 0xFFFFFFFF),
+                                    delta + part));
+                                if (view == nullptr) {
+                                    is_sent = false;
+                                    break;
+                                }
+                                const bool is_written = write_region(
+                                    transfer, position, total, view + delta, part,
+                                    frame, chunk_size, on_progress);
+                                UnmapViewOfFile(view);
+                                if (!is_written) {
+                                    is_sent = false;
+                                    break;
+                                }
+                                position += part;
+                            }
+                        }
+                    }
+                }
+                catch(...) {
+                    is_sent = false;
+                }
+                if (mapping != NULL) CloseHandle(mapping);
+                CloseHandle(file);
+                return is_sent;
+            }
+
+            /** \brief Отправить сообщение
+             * \param out_message Сообщение
+             * \param callback Обратный вызов для ошибки
+             */
+            void send(
+                    const std::string &out_message,
+                    const std::function<void(const std::error_code &ec)> &callback = nullptr) noexcept {
+                write_message(out_message.data(), out_message.size(), callback);
+            }
+
+            /** \brief Отправить двоичное сообщение
+             *
+             * Структура записывается в канал вместе с заголовком кадра
+             * без промежуточной строки.
+             * \param out_message Сообщение, тип объявлен через SIMPLE_NAMED_PIPE_MESSAGE_TYPE
+             * \param callback Обратный вызов для ошибки
+             */
+            template<class T>
+            typename std::enable_if<MessageType<T>::is_message>::type send(
+                    const T &out_message,
+                    const std::function<void(const std::error_code &ec)> &callback = nullptr) noexcept {
+                char frame[sizeof(FrameHeader) + sizeof(T)];
+                write_typed_frame(out_message, frame);
+                write(frame, sizeof(frame), callback);
+            }
+
+            /** \brief Отправить сообщение в логический канал
+             * \param channel Номер канала, открытого клиентом
+             * \param out_message Сообщение
+             * \param callback Обратный вызов для ошибки
+             * \return Вернет false, если канал не открыт
+             */
+            bool send_channel(
+                    const uint32_t channel,
+                    const std::string &out_message,
+                    const std::function<void(const std::error_code &ec)> &callback = nullptr) noexcept {
+                if (!is_channel_open(channel)) return false;
+                try {
+                    const BufferString frame = make_channel_frame<BufferString>(
+                        channel, CHANNEL_DATA, out_message.data(), out_message.size(),
+                        ResourceAllocator<char>(server->memory_resource));
+                    write_message(frame.data(), frame.size(), callback);
+                }
+                catch(...) {
+                    return false;
+                }
+                return true;
+            }
+
+            /** \brief Закрыть логический канал
+             *
+             * Клиент получит закрытие канала, on_channel_close сервера не вызывается.
+             * \param channel Номер канала
+             * \return Вернет false, если канал не открыт
+             */
+            bool close_channel(const uint32_t channel) noexcept {
+                {
+                    std::lock_guard<mutex_t> locker(channels_mutex);
+                    if (channels.erase(channel) == 0) return false;
+                }
+                char frame[sizeof(FrameHeader)];
+                write_frame_header(FRAME_CHANNEL, CHANNEL_CLOSE, channel, 0, frame);
+                write(frame, sizeof(frame), nullptr);
+                return true;
+            }
+
+            /** \brief Проверить, открыт ли логический канал
+             */
+            inline bool is_channel_open(const uint32_t channel) noexcept {
+                std::lock_guard<mutex_t> locker(channels_mutex);
+                return channels.count(channel) != 0;
+            }
+
+            /** \brief Закрыть соединение
+             */
+            inline void close() noexcept {
+                is_reset = true;
+                wake();
+            }
+
+            /** \brief Проверить закрытие соединения
+             * \return Вернет true, если соединение закрыто
+             */
+            inline bool check_close() noexcept {
+                return state.is_close;
+            }
+
+            inline HANDLE get_handle() noexcept {
+                std::lock_guard<mutex_t> lock(pipe_mutex);
+                return pipe;
+            }
+        };
+
+        inline void clear_connections() noexcept {
+            // удаляем потоки, где соединение закрыто
+            std::lock_guard<mutex_t> lock(connections_mutex);
+            if(connections.size() == 0) return;
+            auto it = connections.begin();
+            while(it != connections.end()) {
+                if(it->check_close()) {
+                    timers.cancel(&it->timer_node);
+                    ConnectionState &state = it->state;
+                    it = connections.erase(it);
+                    release_state(state);
+                    ++closed_connections;
+                    continue;
+                }
+                it++;
+            }
+        }
+
+        inline void close_connections() noexcept {
+            // отправляем команду завершения всем соединениям, не дожидаясь их потоков
+            std::lock_guard<mutex_t> locker(connections_mutex);
+            for (auto &it : connections) {
+                it.close();
+            }
+        }
+
+        inline void reset_connections() noexcept {
+            // сначала закрываем все соединения, затем удаляем их потоки
+            std::lock_guard<mutex_t> locker(connections_mutex);
+            if (connections.empty()) return;
+            for (auto &it : connections) {
+                it.close();
+                timers.cancel(&it.timer_node);
+            }
+            closed_connections += connections.size();
+            // блоки состояний освобождаются после завершения потоков соединений
+            while (!connections.empty()) {
+                ConnectionState &state = connections.front().state;
+                connections.pop_front();
+                release_state(state);
+            }
+        }
+
+        /** \brief Занять блок состояния для нового соединения
+         *
+         * Вызывается под connections_mutex.
+         */
+        ConnectionState &acquire_state() {
+            ConnectionState *state = free_state;
+            if (state != nullptr) {
+                free_state = state->next_free;
+            } else {
+                connection_states.emplace_back();
+                state = &connection_states.back();
+            }
+            state->is_used = true;
+            return *state;
+        }
+
+        /** \brief Вернуть блок состояния удаленного соединения
+         *
+         * Вызывается под connections_mutex.
+         */
+        void release_state(ConnectionState &state) noexcept {
+            state.is_used = false;
+            state.buffer_capacity = 0;
+            state.next_free = free_state;
+            free_state = &state;
+        }
+
+    private:
+
+        /** \brief Обработчик двоичного сообщения, возвращает false при неверном размере данных */
+        using typed_handler_t = std::function<bool(Connection*, const char*, size_t)>;
+        std::unordered_map<uint32_t, typed_handler_t> typed_handlers;
+
+        /** \brief Передать кадр двоичного сообщения его обработчику
+         * \return Вернет true, если сообщение обработано
+         */
+        bool dispatch_typed(Connection *connection, const char *data, const size_t size) {
+            if (typed_handlers.empty()) return false;
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_TYPED) return false;
+            auto it = typed_handlers.find(header.id);
+            if (it == typed_handlers.end()) return false;
+            if (!it->second(connection, data + sizeof(FrameHeader), header.size)) {
+                if (on_error) on_error(connection, std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+            }
+            return true;
+        }
+
+        using route_handler_t = std::function<void(Connection*, const std::string &in_message)>;
+        KeyScanner route_scanner;                                       /**< Сканер ключа маршрутизации */
+        std::unordered_map<std::string, route_handler_t> route_handlers;/**< Обработчики по значению ключа */
+
+        /** \brief Обработать кадр логического канала
+         * \return Вернет true, если сообщение было кадром канала
+         */
+        bool dispatch_channel(Connection *connection, const char *data, const size_t size) {
+            FrameHeader header;
+            if (!parse_frame(data, size, header) || header.kind != FRAME_CHANNEL) return false;
+            if (header.flags == CHANNEL_OPEN) {
+                bool is_inserted = false;
+                {
+                    std::lock_guard<mutex_t> locker(connection->channels_mutex);
+                    is_inserted = connection->channels.insert(header.id).second;
+                }
+                if (is_inserted && on_channel_open) on_channel_open(connection, header.id);
+            } else
+            if (header.flags == CHANNEL_CLOSE) {
+                size_t erased = 0;
+                {
+                    std::lock_guard<mutex_t> locker(connection->channels_mutex);
+                    erased = connection->channels.erase(header.id);
+                }
+                if (erased != 0 && on_channel_close) on_channel_close(connection, header.id);
+            } else {
+                if (!connection->is_channel_open(header.id)) {
+                    if (on_error) on_error(connection, std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+                    return true;
+                }
+                if (on_channel_message) {
+                    on_channel_message(connection, header.id, std::string(data + sizeof(FrameHeader), header.size));
+                }
+            }
+            return true;
+        }
+
+        /** \brief Обработать кадр согласования возможностей
+         *
+         * Сжатие включается, если клиент его запросил и словари совпадают.
+         * Клиент получает ответный кадр с принятыми возможностями.
+         */
+        void dispatch_hello(Connection *connection, const FrameHeader &header, const char *data) {
+            uint32_t features = 0;
+            if ((header.id & FEATURE_CHECKSUM) && is_checksum) features |= FEATURE_CHECKSUM;
+            if ((header.id & FEATURE_DELTA) && delta_full_interval != 0) features |= FEATURE_DELTA;
+            if ((header.id & FEATURE_COMPRESSION) && compression && header.size >= sizeof(HelloHeader)) {
+                HelloHeader hello;
+                std::memcpy(&hello, data + sizeof(FrameHeader), sizeof(HelloHeader));
+                if (hello.dictionary_id == compression->get_id()) features |= FEATURE_COMPRESSION;
+            }
+            char frame[HELLO_FRAME_SIZE];
+            write_hello_frame(features, compression ? compression->get_id() : 0, frame);
+            // ответ уже идет с контрольной суммой, если она принята
+            std::unique_lock<mutex_t> locker(connection->pipe_mutex);
+            connection->features = features;
+            connection->write_locked(locker, frame, sizeof(frame), nullptr);
+        }
+
+        /** \brief Передать входящее сообщение обработчикам
+         *
+         * Кадры с контрольной суммой проверяются и раскрываются, сжатые кадры
+         * распаковываются, затем сообщение проходит обычную цепочку обработчиков.
+         * Клиент добавляет контрольную сумму после ответа на согласование,
+         * поэтому после первого такого кадра сообщения без нее отклоняются,
+         * как и кадры с неверной суммой.
+         */
+        void dispatch_message(Connection *connection, const char *data, size_t size) {
+            FrameHeader header;
+            const bool is_checked = parse_frame(data, size, header) && header.kind == FRAME_CHECKED;
+            if ((is_checked && !check_frame(header, data)) ||
+                (!is_checked && connection->is_checksum_required)) {
+                ++checksum_errors;
+                if (on_error) on_error(connection, std::error_code(static_cast<int>(ERROR_CRC), std::generic_category()));
+                return;
+            }
+            if (is_checked) {
+                if (connection->features & FEATURE_CHECKSUM) connection->is_checksum_required = true;
+                data += sizeof(FrameHeader);
+                size = header.size;
+            }
+            if (parse_frame(data, size, header)) {
+                if (header.kind == FRAME_HELLO) {
+                    dispatch_hello(connection, header, data);
+                    return;
+                }
+                if (header.kind == FRAME_COMPRESSED) {
+                    BufferString message{ResourceAllocator<char>(memory_resource)};
+                    if (!compression || !read_compressed_frame(header, data, *compression, message)) {
+                        if (on_error) on_error(connection, std::error_code(static_cast<int>(ERROR_INVALID_DATA), std::generic_category()));
+                        return;
+                    }
+                    dispatch_plain(connection, message.data(), message.size());
+                    return;
+                }
+            }
+            dispatch_plain(connection, data, size);
+        }
+
+        /** \brief Проверить, является ли сообщение heartbeat клиента
+         *
+         * Heartbeat распознается, только если включен heartbeat или тайм-аут
+         * простоя, иначе такое сообщение - обычные данные приложения.
+         */
+        inline bool is_heartbeat(const char *data, const size_t size) const noexcept {
+            return is_timers_enabled() &&
+                !config.heartbeat_message.empty() &&
+                size == config.heartbeat_message.size() &&
+                std::memcmp(data, config.heartbeat_message.data(), size) == 0;
+        }
+
+        /** \brief Передать несжатое сообщение обработчикам
+         *
+         * Heartbeat клиента только обновляет время активности соединения
+         * и в обработчики не передается (см. is_heartbeat()).
+         */
+        void dispatch_plain(Connection *connection, const char *data, const size_t size) {
+            if (is_heartbeat(data, size)) return;
+            if (!dispatch_channel(connection, data, size) &&
+                !dispatch_typed(connection, data, size) &&
+                !dispatch_route(connection, data, size)) {
+                on_message(connection, std::string(data, size));
+            }
+        }
+
+        /** \brief Передать сообщение обработчику по значению ключа маршрутизации
+         * \return Вернет true, если сообщение обработано
+         */
+        bool dispatch_route(Connection *connection, const char *data, const size_t size) {
+            if (route_handlers.empty()) return false;
+            const char *value = nullptr;
+            size_t value_size = 0;
+            if (!route_scanner.find(data, size, value, value_size)) return false;
+            auto it = route_handlers.find(std::string(value, value_size));
+            if (it == route_handlers.end()) return false;
+            it->second(connection, std::string(data, size));
+            return true;
+        }
+
+        /** \brief Проверить, включены ли таймеры соединений
+         */
+        inline bool is_timers_enabled() const noexcept {
+            return config.heartbeat_interval != 0 || config.idle_timeout != 0;
+        }
+
+        /** \brief Установить таймер соединения на ближайшее событие
+         *
+         * Вызывается под connections_mutex. Время активности хранится в самом
+         * соединении, поэтому чтение и запись не трогают колесо таймеров.
+         */
+        void on_connection_timer(Connection &connection, const uint64_t now_ms) {
+            if (connection.check_close()) return;
+            uint64_t next_ms = UINT64_MAX;
+            if (config.idle_timeout != 0) {
+                const uint64_t last = connection.state.last_receive_ms;
+                const uint64_t idle = now_ms > last ? now_ms - last : 0;
+                if (idle >= config.idle_timeout) {
+                    // клиент не подает признаков жизни, освобождаем соединение
+                    connection.close();
+                    ++evicted_connections;
+                    return;
+                }
+                next_ms = config.idle_timeout - idle;
+            }
+            if (config.heartbeat_interval != 0) {
+                const uint64_t last = connection.state.last_send_ms;
+                uint64_t since = now_ms > last ? now_ms - last : 0;
+                if (since >= config.heartbeat_interval) {
+                    // запись идет в потоке соединения без connections_mutex,
+                    // ее ошибка закроет соединение с мертвым клиентом
+                    connection.state.is_heartbeat_due = true;
+                    connection.wake();
+                    since = 0;
                 }
+                next_ms = std::min(next_ms, (uint64_t)config.heartbeat_interval - since);
             }
+            timers.schedule(&connection.timer_node, (next_ms + timer_tick_ms - 1) / timer_tick_ms);
+        }
 
-            /** \brief Закрыть соединение
-             */
-            inline void close() noexcept {
-                is_reset = true;
-            }
+        /** \brief Обработать сработавшие таймеры соединений
+         */
+        void process_timers() {
+            if (!is_timers_enabled()) return;
+            const uint64_t now_ms = get_time_ms();
+            const uint64_t tick = now_ms / timer_tick_ms;
+            std::lock_guard<mutex_t> locker(connections_mutex);
+            if (tick <= timers.get_tick()) return;
+            timers.advance(tick, [this, now_ms](TimingWheel::Node *node) {
+                on_connection_timer(*static_cast<typename Connection::TimerNode*>(node)->connection, now_ms);
+            });
+        }
 
-            /** \brief Проверить закрытие соединения
-             * \return Вернет true, если соединение закрыто
-             */
-            inline bool check_close() noexcept {
-                return is_close;
+        std::list<Connection> connections;  /**< Список соединений (без отдельного shared_ptr на каждое) */
+        mutex_t connections_mutex;
+
+        bool is_inproc_listening = false;   /**< Сервер зарегистрирован в InprocRegistry */
+
+        /** \brief Создать соединение для подключенного канала
+         * \param pipe   Хендлер подключенного канала
+         * \param inproc Канал внутри процесса, если pipe не задан
+         */
+        void add_connection(const HANDLE pipe, const std::shared_ptr<InprocPipe> &inproc = nullptr) {
+            std::lock_guard<mutex_t> lock(connections_mutex);
+            ConnectionState &state = acquire_state();
+            try {
+                connections.emplace_back(
+                    pipe,
+                    this,
+                    state,
+                    config.buffer_size,
+                    config.thread_stack_size,
+                    inproc);
+            }
+            catch(...) {
+                release_state(state);
+                throw;
+            }
+            if (is_timers_enabled()) {
+                on_connection_timer(connections.back(), get_time_ms());
             }
+            ++accepted_connections;
+        }
 
-            inline HANDLE get_handle() noexcept {
-                std::lock_guard<std::mutex> lock(pipe_mutex);
-                return pipe;
+        /** \brief Создать экземпляр канала
+         */
+        static HANDLE create_pipe(const std::string &pipename, const Config &config) noexcept {
+            return CreateNamedPipeA(
+              (LPCSTR)pipename.c_str(), // имя канала
+              PIPE_ACCESS_DUPLEX |      // двунаправленный доступ
+              FILE_FLAG_OVERLAPPED,
+              PIPE_TYPE_MESSAGE |       // message type pipe
+              PIPE_READMODE_MESSAGE |   // message-read mode
+              PIPE_WAIT,                // blocking mode
+              PIPE_UNLIMITED_INSTANCES, // max. instances
+              config.buffer_size,       // output buffer size
+              config.buffer_size,       // input buffer size
+              config.timeout,           // client time-out
+              NULL);                    // default security attribute
+        }
+
+        /** \brief Извлечь следующее сообщение рассылки
+         *
+         * Вызывается под str_queue_mutex. Сообщения забираются по одному, чтобы
+         * приоритетное сообщение не ждало всю накопленную очередь.
+         * \param out_message Сообщение
+         * \return Вернет false, если очереди пусты
+         */
+        bool pop_broadcast(BufferString &out_message) {
+            if (!str_queue_high.empty() &&
+                (str_queue.empty() || high_burst < max_high_burst)) {
+                out_message = std::move(str_queue_high.front());
+                str_queue_high.pop();
+                ++high_burst;
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_broadcast_id, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST_HIGH, ++trace_dequeue_seq[1]));
+            } else
+            if (!str_queue.empty()) {
+                out_message = std::move(str_queue.front());
+                str_queue.pop();
+                high_burst = 0;
+                SIMPLE_NAMED_PIPE_TRACE_SET(trace_broadcast_id, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST, ++trace_dequeue_seq[0]));
+            } else {
+                return false;
             }
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_DEQUEUE, trace_broadcast_id);
+            return true;
+        }
+
+        /** \brief Сообщение рассылки и его кадры для разных возможностей соединений
+         *
+         * Сжатие и контрольная сумма считаются один раз при первом соединении,
+         * которому они нужны, и готовый кадр записывается во все такие соединения.
+         */
+        class BroadcastFrame {
+        public:
+            const char *data = nullptr;
+            size_t size = 0;
+            BufferString compressed;
+            BufferString checked;               /**< Сообщение с контрольной суммой */
+            BufferString compressed_checked;    /**< Сжатый кадр с контрольной суммой */
+            bool is_compress_tried = false;
+            bool is_compressed = false;
+
+            BroadcastFrame(const char *_data, const size_t _size, const ResourceAllocator<char> &allocator) :
+                data(_data), size(_size), compressed(allocator), checked(allocator), compressed_checked(allocator) {};
         };
 
-        inline void clear_connections() noexcept {
-            // удаляем потоки, где соединение закрыто
-            std::lock_guard<std::mutex> lock(connections_mutex);
-            if(connections.size() == 0) return;
-            auto it = connections.begin();
-            while(it != connections.end()) {
-                if(it->get()->check_close()) {
-                    it = connections.erase(it);
-                    continue;
+        /** \brief Записать сообщение рассылки в соединение
+         */
+        void write_frame(Connection &connection, BroadcastFrame &frame) {
+            // возможности читаются под pipe_mutex, см. Connection::write_locked()
+            std::unique_lock<mutex_t> locker(connection.pipe_mutex);
+            const uint32_t features = connection.features;
+            if ((features & FEATURE_COMPRESSION) && !frame.is_compress_tried) {
+                frame.is_compress_tried = true;
+                if (compression && frame.size >= min_compress_size) {
+                    frame.is_compressed = make_compressed_frame(frame.data, frame.size, *compression, frame.compressed);
+                    if (frame.is_compressed) {
+                        compress_input_bytes += frame.size;
+                        compress_output_bytes += frame.compressed.size();
+                    }
                 }
-                it++;
+            }
+            const bool is_compression = (features & FEATURE_COMPRESSION) && frame.is_compressed;
+            const char *data = is_compression ? frame.compressed.data() : frame.data;
+            const size_t size = is_compression ? frame.compressed.size() : frame.size;
+            if (features & FEATURE_CHECKSUM) {
+                BufferString &checked = is_compression ? frame.compressed_checked : frame.checked;
+                if (checked.empty()) make_checked_frame(data, size, checked);
+                connection.write_pipe(locker, checked.data(), checked.size(), nullptr);
+            } else {
+                connection.write_pipe(locker, data, size, nullptr);
             }
         }
 
-        inline void reset_connections() noexcept {
-            // удаляем потоки, где соединение закрыто
-            std::lock_guard<std::mutex> locker(connections_mutex);
-            if (connections.empty()) return;
-            auto it = connections.begin();
-            while(it != connections.end()) {
-                if(it->get()->check_close()) {
-                    it->get()->close();
+        /** \brief Разослать значение ключа
+         *
+         * Вызывается под connections_mutex. Соединения с разностным кодированием,
+         * у которых есть предыдущая версия значения, получают одну общую разность,
+         * остальные - полное значение. Раз в delta_full_interval обновлений
+         * ключа полное значение получают все. Соединения без разностного
+         * кодирования получают само значение.
+         * \param out_message   Кадр из send_all_keyed()
+         * \param header        Разобранный заголовок кадра
+         */
+        void write_delta_broadcast(const BufferString &out_message, const FrameHeader &header) {
+            std::string key;
+            const char *value = nullptr;
+            size_t value_size = 0;
+            if (!parse_delta_frame(header, out_message.data(), key, value, value_size)) return;
+
+            auto it = delta_states.find(key);
+            if (it == delta_states.end()) {
+                it = delta_states.emplace(key, DeltaState()).first;
+                it->second.index = delta_states.size() - 1;
+            }
+            DeltaState &state = it->second;
+            const uint32_t base = state.version;
+            // после переполнения версии нумерация начинается заново с полного значения
+            const bool is_full = base == 0 || base == UINT32_MAX || ++state.updates >= delta_full_interval;
+            if (is_full) state.updates = 0;
+            state.version = base == UINT32_MAX ? 1 : base + 1;
+
+            const ResourceAllocator<char> allocator(memory_resource);
+            BroadcastFrame plain(value, value_size, allocator);
+            BufferString full{allocator};
+            BufferString patch{allocator};
+            BroadcastFrame full_frame(nullptr, 0, allocator);
+            BroadcastFrame patch_frame(nullptr, 0, allocator);
+            bool is_patch_tried = is_full;
+            bool is_patch = false;
+
+            for (auto &connection : connections) {
+                if (connection.check_close()) continue;
+                if (!(connection.features & FEATURE_DELTA)) {
+                    write_frame(connection, plain);
+                    continue;
                 }
-                it++;
+                std::vector<uint32_t> &versions = connection.delta_versions;
+                if (versions.size() <= state.index) versions.resize(state.index + 1, 0);
+                const bool is_actual = !is_full && versions[state.index] == base;
+                if (is_actual && !is_patch_tried) {
+                    is_patch_tried = true;
+                    is_patch = make_delta_patch_frame(state.version, key.data(), key.size(),
+                        state.value.data(), state.value.size(), value, value_size, patch);
+                    patch_frame.data = patch.data();
+                    patch_frame.size = patch.size();
+                }
+                BroadcastFrame *frame = &patch_frame;
+                if (!is_actual || !is_patch) {
+                    if (full.empty()) {
+                        make_delta_full_frame(state.version, key.data(), key.size(), value, value_size, full);
+                        full_frame.data = full.data();
+                        full_frame.size = full.size();
+                    }
+                    frame = &full_frame;
+                }
+                write_frame(connection, *frame);
+                versions[state.index] = state.version;
+                delta_input_bytes += value_size;
+                delta_output_bytes += frame->size;
             }
-            connections.clear();
+            state.value.assign(value, value_size);
         }
 
-    private:
-
-        std::list<std::shared_ptr<Connection>> connections; /**< Список соединений */
-        std::mutex connections_mutex;
+        /** \brief Записать сообщение рассылки во все открытые соединения
+         */
+        void write_broadcast(const BufferString &out_message) {
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_BEGIN, trace_broadcast_id);
+            {
+                std::lock_guard<mutex_t> locker(connections_mutex);
+                FrameHeader header;
+                // значения ключей send_all_keyed() идут в очереди кадром с нулевой версией
+                if (parse_frame(out_message.data(), out_message.size(), header) &&
+                    header.kind == FRAME_DELTA && header.id == 0) {
+                    write_delta_broadcast(out_message, header);
+                } else {
+                    BroadcastFrame frame(out_message.data(), out_message.size(), ResourceAllocator<char>(memory_resource));
+                    for (auto &connection : connections) {
+                        if (!connection.check_close()) write_frame(connection, frame);
+                    }
+                }
+            }
+            SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_WRITE_END, trace_broadcast_id);
+        }
 
         /** \brief Инициализировать сервер
          *
          * \param config Настройки сервера
          * \return Вернет true, если инициализация прошла успешно
          */
-        bool init(Config &config) noexcept {
+        bool init(Config &config, const bool is_accept) noexcept {
+            static_assert(!LockPolicy::is_single_threaded,
+                "SingleThreadedLock: the server must not start its own threads, use start_poll()");
             if (named_pipe_future.valid()) return false;
             std::string pipename("\\\\.\\pipe\\");
             if (config.name.find("\\") != std::string::npos) return false;
             pipename += config.name;
             if (pipename.length() > 256) return false;
+            if (stop_event == NULL || connect_event == NULL) return false;
 
-            /* запоминаем имя соединения */
-            {
-                std::lock_guard<std::mutex> lock(connection_pipe_name_mutex);
-                connection_pipe_name = pipename;
-            }
-
+            if (!is_accept) {
+                // соединения добавляются через adopt(), ждем только остановки
+                named_pipe_future = std::async(std::launch::async,[this]() {
+                    WaitForSingleObject(stop_event, INFINITE);
+                    reset_connections();
+                });
+            } else
             named_pipe_future = std::async(std::launch::async,[
                     this,
                     pipename,
                     config]() {
                 while(!is_reset) {
 
-                    pipe = CreateNamedPipeA(
-                      (LPCSTR)pipename.c_str(), // имя канала
-                      PIPE_ACCESS_DUPLEX |      // двунаправленный доступ
-                      FILE_FLAG_OVERLAPPED,
-                      PIPE_TYPE_MESSAGE |       // message type pipe
-                      PIPE_READMODE_MESSAGE |   // message-read mode
-                      PIPE_WAIT,                // blocking mode
-                      PIPE_UNLIMITED_INSTANCES, // max. instances
-                      config.buffer_size,       // output buffer size
-                      config.buffer_size,       // input buffer size
-                      config.timeout,           // client time-out
-                      NULL);                    // default security attribute
+                    pipe = create_pipe(pipename, config);
 
                     if (pipe == INVALID_HANDLE_VALUE) {
                         // std::cerr << "NamedPipeServer::init(), CreateNamedPipeA failed, GLE=" << GetLastError() << std::endl;
@@ -365,16 +1764,31 @@ namespace SimpleNamedPipe {
                         return;
                     }
 
-                    // устанавливем флаг соединения (необходим для хака во время остановки сервера)
-                    is_connection = true;
-
-                    // ждем соединения с сервером
-                    BOOL named_pipe_connected = ConnectNamedPipe(pipe, NULL) ?
-                        TRUE :
-                        (GetLastError() == ERROR_PIPE_CONNECTED);
-
-                    // снимаем флаг соединения (необходим для хака во время остановки сервера)
-                    is_connection = false;
+                    // ждем соединения с сервером или остановки сервера
+                    OVERLAPPED overlapped;
+                    std::memset(&overlapped, 0, sizeof(overlapped));
+                    overlapped.hEvent = connect_event;
+                    ResetEvent(connect_event);
+
+                    BOOL named_pipe_connected = ConnectNamedPipe(pipe, &overlapped);
+                    if (!named_pipe_connected) {
+                        const DWORD err = GetLastError();
+                        if (err == ERROR_PIPE_CONNECTED) {
+                            named_pipe_connected = TRUE;
+                        } else
+                        if (err == ERROR_IO_PENDING) {
+                            const HANDLE events[2] = {connect_event, stop_event};
+                            const DWORD result = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+                            DWORD bytes = 0;
+                            if (result == WAIT_OBJECT_0) {
+                                named_pipe_connected = GetOverlappedResult(pipe, &overlapped, &bytes, FALSE);
+                            } else {
+                                // остановка сервера, отменяем ожидание подключения
+                                CancelIo(pipe);
+                                GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+                            }
+                        }
+                    }
 
                     // если бы сброс, выходим
                     if (is_reset) {
@@ -383,16 +1797,15 @@ namespace SimpleNamedPipe {
                         return;
                     }
 
+                    const auto accept_time = std::chrono::steady_clock::now();
                     if (named_pipe_connected) {
-                        // создаем отдельный поток для приема и передачи сообщений
-                        std::lock_guard<std::mutex> lock(connections_mutex);
-                        connections.push_back(std::make_shared<Connection>(
-                            pipe,
-                            on_open,
-                            on_message,
-                            on_close,
-                            on_error,
-                            config.buffer_size));
+                        if (on_accept && on_accept(pipe)) {
+                            // канал передан обработчику, например рабочему процессу
+                            ++accepted_connections;
+                        } else {
+                            // создаем отдельный поток для приема и передачи сообщений
+                            add_connection(pipe);
+                        }
                     } else {
                         CloseHandle(pipe);
                     }
@@ -400,100 +1813,554 @@ namespace SimpleNamedPipe {
                     // удаляем потоки, где соединение закрыто
                     clear_connections();
 
+                    // время, в течение которого новые клиенты не могли подключиться
+                    const uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - accept_time).count();
+                    accept_latency_us = latency;
+                    if (latency > max_accept_latency_us) max_accept_latency_us = latency;
+
                     std::this_thread::yield();
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 }
                 reset_connections();
             });
 
             named_pipe_send_future = std::async(std::launch::async,[this]() {
+                auto last_clear = std::chrono::steady_clock::now();
                 while (!is_reset) {
-                    std::queue<std::string> messages_queue;
+                    BufferString out_message{ResourceAllocator<char>(memory_resource)};
+                    bool is_message = false;
                     {
-                        std::unique_lock<std::mutex> locker(str_queue_mutex);
-                        str_queue_check.wait(locker, [this](){return !str_queue.empty() || is_reset;});
+                        std::unique_lock<mutex_t> locker(str_queue_mutex);
+                        const auto period = is_timers_enabled() ?
+                            std::chrono::milliseconds(timer_tick_ms) : clear_period;
+                        str_queue_check.wait_for(locker, period, [this](){
+                            return !str_queue.empty() || !str_queue_high.empty() || is_reset;
+                        });
                         if (is_reset) return;
-                        std::swap(str_queue, messages_queue);
+                        is_message = pop_broadcast(out_message);
                     }
-                    if (messages_queue.empty()) {
-                        std::this_thread::yield();
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                        continue;
-                    }
-
-                    while (!messages_queue.empty()) {
-                        std::string out_message = messages_queue.front();
-                        messages_queue.pop();
-                        std::lock_guard<std::mutex> locker(connections_mutex);
-                        auto it = connections.begin();
-                        while (it != connections.end()) {
-                            if (!it->get()->check_close()) {
-                                it->get()->send(out_message);
-                            }
-                            it++;
-                        }
+                    if (is_message) write_broadcast(out_message);
+                    process_timers();
+                    // соединения могут закрываться без новых подключений, а очередь
+                    // рассылки может не пустеть часами, поэтому потоки закрытых
+                    // соединений удаляем по времени
+                    const auto now = std::chrono::steady_clock::now();
+                    if ((now - last_clear) >= clear_period) {
+                        last_clear = now;
+                        clear_connections();
                     }
                 }
             });
+
+            // клиенты этого же процесса подключаются по имени "inproc:" + name
+            is_inproc_listening = InprocRegistry::listen(config.name, [this](const std::shared_ptr<InprocPipe> &inproc) {
+                return adopt_inproc(inproc);
+            });
+            return true;
+        }
+
+        /** \brief Добавить соединение клиента этого же процесса
+         *
+         * Вызывается из потока клиента под мьютексом реестра InprocRegistry.
+         */
+        bool adopt_inproc(const std::shared_ptr<InprocPipe> &inproc) noexcept {
+            if (is_reset) return false;
+            try {
+                add_connection(INVALID_HANDLE_VALUE, inproc);
+            }
+            catch(...) {
+                return false;
+            }
             return true;
         }
 
+        /** \brief Создать экземпляр канала и начать ожидание подключения (режим опроса)
+         *
+         * Подключение клиента переводит connect_event в сигнальное состояние.
+         */
+        void listen_pipe() noexcept {
+            pipe = create_pipe(poll_pipename, config);
+            if (pipe == INVALID_HANDLE_VALUE) {
+                is_error = true;
+                return;
+            }
+            std::memset(&connect_overlapped, 0, sizeof(connect_overlapped));
+            connect_overlapped.hEvent = connect_event;
+            ResetEvent(connect_event);
+            is_pipe_connected = false;
+            if (ConnectNamedPipe(pipe, &connect_overlapped)) {
+                is_pipe_connected = true;
+                return;
+            }
+            const DWORD err = GetLastError();
+            if (err == ERROR_PIPE_CONNECTED) {
+                // клиент успел подключиться, ожидания не будет
+                is_pipe_connected = true;
+                SetEvent(connect_event);
+            } else
+            if (err != ERROR_IO_PENDING) {
+                // экземпляр пересоздается при следующем poll_once()
+                CloseHandle(pipe);
+                pipe = INVALID_HANDLE_VALUE;
+                SetEvent(connect_event);
+            }
+        }
+
+        /** \brief Принять подключенного клиента без ожидания (режим опроса)
+         */
+        void poll_accept() {
+            if (pipe == INVALID_HANDLE_VALUE) {
+                if (!is_error) listen_pipe();
+                return;
+            }
+            if (!is_pipe_connected) {
+                DWORD bytes = 0;
+                if (!GetOverlappedResult(pipe, &connect_overlapped, &bytes, FALSE)) {
+                    if (GetLastError() == ERROR_IO_INCOMPLETE) return;
+                    CloseHandle(pipe);
+                    listen_pipe();
+                    return;
+                }
+            }
+            const HANDLE client = pipe;
+            pipe = INVALID_HANDLE_VALUE;
+            if (on_accept && on_accept(client)) {
+                ++accepted_connections;
+            } else {
+                add_connection(client);
+            }
+            listen_pipe();
+        }
+
+        /** \brief Остановить прием подключений и закрыть соединения (режим опроса)
+         *
+         * Вызывается из stop() после close_connections().
+         */
+        void stop_poll() noexcept {
+            if (pipe != INVALID_HANDLE_VALUE) {
+                if (!is_pipe_connected) {
+                    CancelIo(pipe);
+                    DWORD bytes = 0;
+                    GetOverlappedResult(pipe, &connect_overlapped, &bytes, TRUE);
+                }
+                CloseHandle(pipe);
+                pipe = INVALID_HANDLE_VALUE;
+            }
+            // соединения уже закрыты, poll() вызывает on_close и освобождает каналы
+            for (auto &it : connections) {
+                it.poll(0);
+            }
+            is_poll = false;
+        }
+
     public:
 
         std::function<void(Connection*)> on_open;
         std::function<void(Connection*, const std::string &in_message)> on_message;
         std::function<void(Connection*)> on_close;
         std::function<void(Connection*, const std::error_code &)> on_error;
+        std::function<void(Connection*)> on_rate_limit; /**< Чтение соединения приостановлено лимитом скорости */
+
+        std::function<void(Connection*, uint32_t channel)> on_channel_open;    /**< Клиент открыл логический канал */
+        std::function<void(Connection*, uint32_t channel, const std::string &in_message)> on_channel_message; /**< Сообщение логического канала */
+        std::function<void(Connection*, uint32_t channel)> on_channel_close;   /**< Логический канал закрыт клиентом или вместе с соединением */
+
+        /** \brief Обработчик принятого канала
+         *
+         * Вызывается в потоке приема до создания соединения. Если обработчик
+         * вернул true, он становится владельцем хендлера канала и соединение
+         * не создается. Используется для передачи каналов рабочим процессам.
+         */
+        std::function<bool(HANDLE pipe)> on_accept;
+
+        /** \brief Установить лимит скорости входящих сообщений для каждого соединения
+         *
+         * При превышении лимита сервер не теряет данные, а приостанавливает чтение
+         * из канала соединения. Лимит устанавливается до запуска сервера.
+         * \param message_rate  Сообщений в секунду, 0 - без лимита
+         * \param byte_rate     Байтов в секунду, 0 - без лимита
+         * \param message_burst Допустимый всплеск сообщений, 0 - равен message_rate
+         * \param byte_burst    Допустимый всплеск байтов, 0 - равен byte_rate
+         */
+        inline void set_rate_limit(
+                const double message_rate,
+                const double byte_rate,
+                const double message_burst = 0,
+                const double byte_burst = 0) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            config.message_rate = message_rate;
+            config.byte_rate = byte_rate;
+            config.message_burst = message_burst;
+            config.byte_burst = byte_burst;
+        }
+
+        /** \brief Включить heartbeat
+         *
+         * Если соединению ничего не отправлялось в течение interval,
+         * сервер отправляет ему сообщение heartbeat. Ошибка записи закрывает
+         * соединение. Пока interval или тайм-аут простоя (set_idle_timeout())
+         * не равны 0, входящие сообщения, равные message, в обработчики не
+         * передаются. Если оба равны 0, такие сообщения приходят в on_message
+         * как обычные данные. Устанавливается до запуска сервера.
+         * \param interval  Период, мс, 0 - отключить
+         * \param message   Сообщение heartbeat
+         */
+        inline void set_heartbeat(const size_t interval, const std::string &message = "{\"heartbeat\":1}") noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            config.heartbeat_interval = interval;
+            config.heartbeat_message = message;
+        }
+
+        /** \brief Установить тайм-аут простоя соединения
+         *
+         * Соединение, от которого не было входящих сообщений дольше timeout,
+         * закрывается. Клиенты должны отправлять heartbeat чаще этого тайм-аута.
+         * Пока тайм-аут не равен 0, входящие сообщения, равные сообщению
+         * heartbeat (set_heartbeat()), в обработчики не передаются, даже если
+         * сам сервер heartbeat не отправляет. Устанавливается до запуска сервера.
+         * \param timeout Тайм-аут, мс, 0 - отключить
+         */
+        inline void set_idle_timeout(const size_t timeout) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            config.idle_timeout = timeout;
+        }
+
+        /** \brief Установить границы размера буфера чтения соединения
+         *
+         * Буфер каждого соединения начинается с buffer_size, растет под
+         * крупные сообщения до max_size и уменьшается до min_size при
+         * небольших сообщениях. Устанавливается до запуска сервера.
+         * \param min_size Наименьший размер буфера
+         * \param max_size Наибольший размер буфера, более крупные сообщения читаются частично
+         */
+        inline void set_buffer_limits(const size_t min_size, const size_t max_size) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            config.min_buffer_size = min_size;
+            config.max_buffer_size = max_size;
+        }
+
+        /** \brief Установить источник памяти
+         *
+         * Из него выделяются очереди сообщений send_all вместе с блоками
+         * самих очередей и буферы чтения соединений. Источник должен
+         * существовать дольше сервера. Устанавливается до запуска сервера.
+         * \param resource Источник памяти, nullptr - глобальная куча
+         */
+        inline void set_memory_resource(MemoryResource *resource) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            memory_resource = resource ? resource : AllocatorPolicy::get_memory_resource();
+            std::lock_guard<mutex_t> queue_lock(str_queue_mutex);
+            try {
+                rebind_queue(str_queue, memory_resource);
+                rebind_queue(str_queue_high, memory_resource);
+            }
+            catch(...) {}
+        }
+
+        /** \brief Включить сжатие сообщений общим словарем
+         *
+         * Сжатие согласуется с каждым клиентом отдельно: клиент должен
+         * включить сжатие тем же словарем. Остальные клиенты получают
+         * сообщения без сжатия. Устанавливается до запуска сервера.
+         * \param dictionary    Словарь, nullptr - выключить сжатие
+         * \param min_size      Сообщения короче не сжимаются
+         */
+        inline void set_compression(
+                std::shared_ptr<const CompressionDictionary> dictionary,
+                const size_t min_size = 128) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            compression = std::move(dictionary);
+            min_compress_size = min_size;
+        }
+
+        /** \brief Разрешить контрольную сумму сообщений
+         *
+         * Контрольная сумма CRC32C добавляется к сообщениям в обе стороны
+         * для клиентов, которые ее запросили. Сообщения с неверной суммой
+         * не передаются обработчикам, вызывается on_error с ERROR_CRC.
+         * Устанавливается до запуска сервера.
+         * \param value Разрешить контрольную сумму
+         */
+        inline void set_checksum(const bool value) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            is_checksum = value;
+        }
+
+        /** \brief Включить разностное кодирование значений ключей
+         *
+         * Значения, отправленные через send_all_keyed(), клиенты с разностным
+         * кодированием получают как разность с предыдущим значением ключа,
+         * а клиент восстанавливает полное значение до on_message. Новые
+         * соединения и каждые full_interval обновлений ключа получают полное
+         * значение. Сервер хранит последнее значение каждого ключа.
+         * Устанавливается до запуска сервера.
+         * \param full_interval Полное значение отправляется каждые столько обновлений ключа, 0 - выключить
+         */
+        inline void set_delta(const size_t full_interval = 64) noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            delta_full_interval = full_interval;
+        }
+
+        /** \brief Установить обработчик двоичного сообщения
+         *
+         * Обработчики устанавливаются до запуска сервера.
+         * Кадры зарегистрированных типов не передаются в on_message.
+         * \param handler Обработчик сообщения, тип объявлен через SIMPLE_NAMED_PIPE_MESSAGE_TYPE
+         */
+        template<class T>
+        void on_typed_message(std::function<void(Connection*, const T &in_message)> handler) {
+            static_assert(MessageType<T>::is_message, "Type is not declared with SIMPLE_NAMED_PIPE_MESSAGE_TYPE");
+            typed_handlers[MessageType<T>::id] = [handler](Connection* connection, const char *data, size_t size) {
+                return dispatch_typed_frame<T>(data, size, [&](const T &value) {
+                    handler(connection, value);
+                });
+            };
+        }
+
+        /** \brief Установить ключ маршрутизации
+         *
+         * Значение ключа извлекается из входящих сообщений без полного
+         * разбора JSON и используется для выбора обработчика из on_route.
+         * \param key Имя ключа, например "symbol" или "type"
+         */
+        inline void set_route_key(const std::string &key) {
+            route_scanner.set_key(key);
+        }
+
+        /** \brief Установить обработчик сообщений с заданным значением ключа маршрутизации
+         *
+         * Обработчики устанавливаются до запуска сервера. Сообщения без ключа
+         * или с незарегистрированным значением передаются в on_message.
+         * \param value   Значение ключа (строка без кавычек или число)
+         * \param handler Обработчик сообщения
+         */
+        inline void on_route(
+                const std::string &value,
+                std::function<void(Connection*, const std::string &in_message)> handler) {
+            route_handlers[value] = std::move(handler);
+        }
 
         /** \brief Конструктор класса сервера именованных каналов
          *
          * \param name          Имя именованного канала
          * \param buffer_size   Размер буфера для чтения и записи
          * \param timeout       Время ожидания
+         * \param thread_stack_size Резерв стека потока каждого соединения
          */
-        NamedPipeServer(
+        BasicNamedPipeServer(
                 const std::string &name,
                 const size_t buffer_size = 2048,
-                const size_t timeout = 0) {
+                const size_t timeout = 0,
+                const size_t thread_stack_size = 256 * 1024) {
             is_reset = false;
             is_error = false;
-            is_connection = false;
+            stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            connect_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            accepted_connections = 0;
+            closed_connections = 0;
+            throttled_reads = 0;
+            transfer_counter = 0;
+            compress_input_bytes = 0;
+            compress_output_bytes = 0;
+            checksum_errors = 0;
+            delta_input_bytes = 0;
+            delta_output_bytes = 0;
+            evicted_connections = 0;
+            accept_latency_us = 0;
+            max_accept_latency_us = 0;
             config.name = name;
             config.buffer_size = buffer_size;
             config.timeout = timeout;
+            config.thread_stack_size = thread_stack_size;
         }
 
         /** \brief Запустить сервер
          */
         inline bool start() noexcept {
-            std::lock_guard<std::mutex> lock(method_mutex);
+            std::lock_guard<mutex_t> lock(method_mutex);
+            is_reset = false;
+            if (stop_event != NULL) ResetEvent(stop_event);
+            return init(config, true);
+        }
+
+        /** \brief Запустить сервер без приема подключений
+         *
+         * Сервер не создает экземпляры канала, соединения добавляются
+         * методом adopt(). Используется в рабочих процессах.
+         */
+        inline bool start_worker() noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
             is_reset = false;
-            return init(config);
+            if (stop_event != NULL) ResetEvent(stop_event);
+            return init(config, false);
+        }
+
+        /** \brief Запустить сервер в режиме опроса
+         *
+         * Сервер не создает потоков: прием подключений, чтение и таймеры
+         * выполняются в poll_once(), рассылка send_all() - в flush(). Оба метода
+         * вызываются из цикла событий приложения, который ждет хендлеры
+         * get_wait_handles() не дольше get_poll_timeout(). Обработчики
+         * вызываются в потоке цикла. Подключения внутри процесса (inproc:)
+         * и adopt() в этом режиме недоступны.
+         * \return Вернет true, если первый экземпляр канала создан
+         */
+        bool start_poll() noexcept {
+            std::lock_guard<mutex_t> lock(method_mutex);
+            if (is_poll || named_pipe_future.valid()) return false;
+            if (config.name.find("\\") != std::string::npos) return false;
+            poll_pipename = "\\\\.\\pipe\\" + config.name;
+            if (poll_pipename.length() > 256) return false;
+            if (stop_event == NULL || connect_event == NULL) return false;
+            is_reset = false;
+            is_error = false;
+            ResetEvent(stop_event);
+            is_poll = true;
+            listen_pipe();
+            if (is_error) {
+                is_poll = false;
+                return false;
+            }
+            return true;
+        }
+
+        /** \brief Выполнить готовую работу сервера без ожидания (режим опроса)
+         *
+         * Принимает подключенного клиента, читает готовые сообщения соединений,
+         * закрывает разорванные соединения и обрабатывает таймеры. Соединения
+         * обходятся по кругу, поэтому при ограничении max_messages
+         * загруженное соединение не задерживает остальные.
+         * \param max_messages Наибольшее количество сообщений за вызов
+         * \return Количество прочитанных сообщений
+         */
+        size_t poll_once(const size_t max_messages = SIZE_MAX) noexcept {
+            if (!is_poll || is_reset) return 0;
+            size_t counter = 0;
+            try {
+                poll_accept();
+                // список меняет только поток цикла, поэтому обходим его без блокировки,
+                // чтобы обработчики могли вызывать методы сервера
+                for (auto &it : connections) {
+                    if (counter >= max_messages) break;
+                    counter += it.poll(max_messages - counter);
+                }
+                {
+                    std::lock_guard<mutex_t> locker(connections_mutex);
+                    if (connections.size() > 1) {
+                        connections.splice(connections.end(), connections, connections.begin());
+                    }
+                }
+                clear_connections();
+                process_timers();
+                for (auto &it : connections) {
+                    it.send_heartbeat();
+                }
+            }
+            catch(...) {}
+            return counter;
+        }
+
+        /** \brief Записать сообщения send_all() во все соединения (режим опроса)
+         * \return Количество разосланных сообщений
+         */
+        size_t flush() noexcept {
+            if (!is_poll) return 0;
+            size_t counter = 0;
+            try {
+                BufferString out_message{ResourceAllocator<char>(memory_resource)};
+                while (!is_reset) {
+                    {
+                        std::lock_guard<mutex_t> locker(str_queue_mutex);
+                        if (!pop_broadcast(out_message)) break;
+                    }
+                    write_broadcast(out_message);
+                    ++counter;
+                }
+            }
+            catch(...) {}
+            return counter;
+        }
+
+        /** \brief Получить хендлеры ожидания для цикла событий (режим опроса)
+         *
+         * Хендлер переходит в сигнальное состояние, когда у poll_once() есть
+         * работа: подключился клиент или в соединение пришли данные. Список
+         * меняется при подключении и закрытии соединений, поэтому его нужно
+         * получать заново после каждого poll_once(). WaitForMultipleObjects
+         * принимает не больше MAXIMUM_WAIT_OBJECTS хендлеров, для большего
+         * числа соединений используйте несколько ожиданий.
+         * \param handles Хендлеры, первым идет событие подключения
+         */
+        void get_wait_handles(std::vector<HANDLE> &handles) {
+            handles.clear();
+            if (!is_poll) return;
+            handles.push_back(connect_event);
+            std::lock_guard<mutex_t> locker(connections_mutex);
+            for (auto &it : connections) {
+                if (!it.check_close()) handles.push_back(it.read_event);
+            }
+        }
+
+        /** \brief Наибольшее время ожидания до следующего poll_once(), мс
+         *
+         * У таймеров heartbeat и простоя нет хендлеров, поэтому при включенных
+         * таймерах цикл должен просыпаться не реже одного такта колеса.
+         * Соединения, чтение которых приостановлено лимитом скорости, не
+         * ждут данных, и цикл просыпается, когда лимит снова позволит читать.
+         */
+        DWORD get_poll_timeout() noexcept {
+            DWORD timeout = is_timers_enabled() ? static_cast<DWORD>(timer_tick_ms) : INFINITE;
+            if (!is_poll) return timeout;
+            const auto now = std::chrono::steady_clock::now();
+            std::lock_guard<mutex_t> locker(connections_mutex);
+            for (auto &it : connections) {
+                if (!it.is_throttled || it.check_close()) continue;
+                if (it.throttle_end <= now) return 0;
+                // округляем вверх, чтобы не проснуться раньше времени
+                const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    it.throttle_end - now + std::chrono::microseconds(999)).count();
+                timeout = std::min(timeout, static_cast<DWORD>(delay));
+            }
+            return timeout;
+        }
+
+        /** \brief Добавить уже подключенный канал
+         *
+         * Сервер становится владельцем хендлера, для канала создается
+         * обычное соединение с обработчиками on_open, on_message и on_close.
+         * \param pipe Хендлер подключенного экземпляра канала этого сервера
+         * \return Вернет false, если сервер не запущен
+         */
+        bool adopt(const HANDLE pipe) noexcept {
+            if (pipe == INVALID_HANDLE_VALUE || pipe == NULL) return false;
+            std::lock_guard<mutex_t> lock(method_mutex);
+            if (is_reset || is_poll || !named_pipe_future.valid()) return false;
+            try {
+                add_connection(pipe);
+            }
+            catch(...) {
+                return false;
+            }
+            return true;
         }
 
         /** \brief Остановить сервер
          */
         inline void stop() noexcept {
-            std::lock_guard<std::mutex> lock(method_mutex);
+            std::lock_guard<mutex_t> lock(method_mutex);
             is_reset = true;
-            if (is_connection) {
-                // применяем лайфхак, чтобы разблочить функцию ConnectNamedPipe
-                HANDLE hack_pipe;
-                {
-                    std::lock_guard<std::mutex> lock(connection_pipe_name_mutex);
-                    hack_pipe = CreateFile(
-                        (LPCSTR)connection_pipe_name.c_str(), // имя канала
-                        GENERIC_READ |  // read and write access
-                        GENERIC_WRITE,
-                        0,              // no sharing
-                        NULL,           // default security attributes
-                        OPEN_EXISTING,  // opens existing pipe
-                        0,              // default attributes
-                        NULL);          // no template file
-                }
-                if(hack_pipe != INVALID_HANDLE_VALUE) {
-                    CloseHandle(pipe);
-                }
+            if (is_inproc_listening) {
+                InprocRegistry::unlisten(config.name);
+                is_inproc_listening = false;
+            }
+            // будим все потоки сервера сразу, затем просим завершиться
+            // все соединения, чтобы их потоки останавливались параллельно
+            if (stop_event != NULL) SetEvent(stop_event);
+            close_connections();
+            if (is_poll) stop_poll();
+            {
+                std::lock_guard<mutex_t> locker(str_queue_mutex);
+                str_queue_check.notify_one();
             }
 
             std::shared_future<void> named_pipe_share = named_pipe_future.share();
@@ -504,7 +2371,6 @@ namespace SimpleNamedPipe {
                 }
                 catch(...) {}
             }
-            str_queue_check.notify_one();
             std::shared_future<void> named_pipe_send_share = named_pipe_send_future.share();
             if(named_pipe_send_share.valid()) {
                 try {
@@ -525,18 +2391,62 @@ namespace SimpleNamedPipe {
 
         /** \brief Отправить сообщение всем клиента
          * \param out_message   Сообщение
+         * \param priority      Приоритет сообщения
          * \return Вернет true, если было хотя бы одно отправление
          */
-        inline bool send_all(const std::string &out_message) noexcept {
+        inline bool send_all(const std::string &out_message, const Priority priority = Priority::NORMAL) noexcept {
             if (get_connections() == 0) return false;
-            std::unique_lock<std::mutex> locker(str_queue_mutex);
-            str_queue.push(out_message);
+            std::unique_lock<mutex_t> locker(str_queue_mutex);
+            if (priority == Priority::HIGH) {
+                str_queue_high.emplace(out_message.data(), out_message.size(), ResourceAllocator<char>(memory_resource));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST_HIGH, ++trace_enqueue_seq[1]));
+            } else {
+                str_queue.emplace(out_message.data(), out_message.size(), ResourceAllocator<char>(memory_resource));
+                SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST, ++trace_enqueue_seq[0]));
+            }
             str_queue_check.notify_one();
             return true;
         }
 
-        ~NamedPipeServer() {
+        /** \brief Отправить всем клиентам новое значение ключа
+         *
+         * Без разностного кодирования (set_delta) работает как send_all().
+         * Иначе клиенты, согласовавшие разностное кодирование, получают
+         * разность с прошлым значением ключа, остальные - само значение.
+         * \param key           Ключ, например символ, не длиннее 65535 байт
+         * \param out_message   Значение
+         * \param priority      Приоритет сообщения
+         * \return Вернет true, если было хотя бы одно отправление
+         */
+        inline bool send_all_keyed(
+                const std::string &key,
+                const std::string &out_message,
+                const Priority priority = Priority::NORMAL) noexcept {
+            if (delta_full_interval == 0 || key.size() > UINT16_MAX) return send_all(out_message, priority);
+            if (get_connections() == 0) return false;
+            try {
+                BufferString frame{ResourceAllocator<char>(memory_resource)};
+                make_delta_full_frame(0, key.data(), key.size(), out_message.data(), out_message.size(), frame);
+                std::unique_lock<mutex_t> locker(str_queue_mutex);
+                if (priority == Priority::HIGH) {
+                    str_queue_high.push(std::move(frame));
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST_HIGH, ++trace_enqueue_seq[1]));
+                } else {
+                    str_queue.push(std::move(frame));
+                    SIMPLE_NAMED_PIPE_TRACE_EVENT(TRACE_ENQUEUE, Trace::get_queue_id(TRACE_FLOW_SERVER_BROADCAST, ++trace_enqueue_seq[0]));
+                }
+                str_queue_check.notify_one();
+            }
+            catch(...) {
+                return false;
+            }
+            return true;
+        }
+
+        ~BasicNamedPipeServer() {
             stop();
+            if (stop_event != NULL) CloseHandle(stop_event);
+            if (connect_event != NULL) CloseHandle(connect_event);
         }
 
         /** \brief Получить количество соединений
@@ -544,16 +2454,75 @@ namespace SimpleNamedPipe {
          */
         inline size_t get_connections() noexcept {
             size_t counter = 0;
-            std::lock_guard<std::mutex> locker(connections_mutex);
+            std::lock_guard<mutex_t> locker(connections_mutex);
             if (connections.empty()) return counter;
-            for (auto it : connections) {
-                if(!it->check_close()) {
+            for (auto &it : connections) {
+                if(!it.check_close()) {
                     ++counter;
                 }
             }
             return counter;
         };
+
+        /** \brief Статистика сервера
+         */
+        class Stats {
+        public:
+            size_t connections = 0;             /**< Количество открытых соединений */
+            size_t threads = 0;                 /**< Количество потоков соединений, включая еще не удаленные */
+            uint64_t accepted = 0;              /**< Всего принятых соединений */
+            uint64_t closed = 0;                /**< Всего удаленных соединений */
+            uint64_t accept_latency_us = 0;     /**< Последнее время простоя между экземплярами канала, мкс */
+            uint64_t max_accept_latency_us = 0; /**< Максимальное время простоя между экземплярами канала, мкс */
+            uint64_t throttled = 0;             /**< Сколько раз чтение приостанавливалось лимитом скорости */
+            uint64_t evicted = 0;               /**< Соединений закрыто по тайм-ауту простоя */
+            size_t buffer_bytes = 0;            /**< Суммарный размер буферов чтения соединений */
+            size_t max_buffer_bytes = 0;        /**< Наибольший буфер чтения соединения */
+            uint64_t compress_input_bytes = 0;  /**< Байт сообщений до сжатия */
+            uint64_t compress_output_bytes = 0; /**< Байт сжатых кадров */
+            uint64_t checksum_errors = 0;       /**< Входящих сообщений с неверной контрольной суммой */
+            uint64_t delta_input_bytes = 0;     /**< Байт значений ключей для соединений с разностным кодированием */
+            uint64_t delta_output_bytes = 0;    /**< Байт кадров значений и разностей для этих соединений */
+        };
+
+        /** \brief Получить статистику сервера
+         * \return Статистика сервера
+         */
+        inline Stats get_stats() noexcept {
+            Stats stats;
+            {
+                std::lock_guard<mutex_t> locker(connections_mutex);
+                stats.threads = connections.size();
+                for (auto &it : connection_states) {
+                    if (!it.is_used) continue;
+                    if (!it.is_close) ++stats.connections;
+                    const size_t capacity = it.buffer_capacity;
+                    stats.buffer_bytes += capacity;
+                    stats.max_buffer_bytes = std::max(stats.max_buffer_bytes, capacity);
+                }
+            }
+            stats.accepted = accepted_connections;
+            stats.closed = closed_connections;
+            stats.accept_latency_us = accept_latency_us;
+            stats.max_accept_latency_us = max_accept_latency_us;
+            stats.throttled = throttled_reads;
+            stats.evicted = evicted_connections;
+            stats.compress_input_bytes = compress_input_bytes;
+            stats.compress_output_bytes = compress_output_bytes;
+            stats.checksum_errors = checksum_errors;
+            stats.delta_input_bytes = delta_input_bytes;
+            stats.delta_output_bytes = delta_output_bytes;
+            return stats;
+        }
     };
+
+    /** \brief Сервер именованных каналов с политиками по умолчанию
+     */
+    using NamedPipeServer = BasicNamedPipeServer<>;
+
+    /** \brief Сервер без блокировок и атомарных переменных для работы из одного потока
+     */
+    using SingleThreadedNamedPipeServer = BasicNamedPipeServer<SingleThreadedLock, SpinWait, PlainStats>;
 }
 
 #endif // SIMPLE_NAMED_PIPE_SERVER_HPP_INCLUDED
@@ -0,0 +1,268 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_SHARDED_CLIENT_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_SHARDED_CLIENT_HPP_INCLUDED
+
+#include "named-pipe-client.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace SimpleNamedPipe {
+
+    /** \brief Клиент нескольких серверов с распределением по ключу
+     *
+     * К каждому серверу из списка подключается отдельный клиент. Сообщение
+     * отправляется серверу, номер которого выбирает shard_function по ключу.
+     * Если этот сервер недоступен, сообщение уходит следующему доступному
+     * серверу по кругу, поэтому все ключи упавшего сервера переходят
+     * к одному соседу. Неотправленные сообщения упавшего сервера переносятся
+     * туда же, а сам сервер проверяется с экспоненциальной паузой и после
+     * подключения снова получает свои ключи. Порядок сообщений одного ключа
+     * сохраняется, пока не меняется сервер этого ключа.
+     */
+    template<class Client = NamedPipeClient>
+    class BasicShardedNamedPipeClient {
+    public:
+        using Priority = typename Client::Priority;
+
+    private:
+
+        /** \brief Сервер из списка
+         */
+        class Endpoint {
+        public:
+            std::unique_ptr<Client> client;
+            bool is_healthy = false;        /**< Соединение открыто, защищен route_mutex */
+        };
+
+        std::vector<std::unique_ptr<Endpoint>> endpoints;
+        std::mutex route_mutex;             /**< Выбор сервера и перенос очередей */
+        std::atomic<uint64_t> failovers;    /**< Сколько раз очередь переносилась на другой сервер */
+        std::atomic<bool> is_stopping;      /**< Клиенты останавливаются, очереди не переносятся */
+
+        size_t reconnect_min_delay = 1;     /**< Начальная пауза проверки упавшего сервера, мс */
+        size_t reconnect_max_delay = 1000;  /**< Наибольшая пауза проверки упавшего сервера, мс */
+
+        /** \brief Найти доступный сервер, начиная с заданного
+         * \return Номер сервера или endpoints.size(), если доступных нет
+         */
+        size_t find_healthy(const size_t first) const noexcept {
+            for (size_t i = 0; i < endpoints.size(); ++i) {
+                const size_t index = (first + i) % endpoints.size();
+                if (endpoints[index]->is_healthy) return index;
+            }
+            return endpoints.size();
+        }
+
+        void handle_open(const size_t index) {
+            {
+                std::lock_guard<std::mutex> lock(route_mutex);
+                endpoints[index]->is_healthy = true;
+            }
+            if (on_open) on_open(index);
+        }
+
+        /** \brief Обработать разрыв соединения
+         *
+         * Вызывается в потоке клиента сервера после on_close клиента:
+         * новые сообщения клиент уже не принимает, поэтому очередь
+         * переносится целиком.
+         */
+        void handle_close(const size_t index) {
+            {
+                std::lock_guard<std::mutex> lock(route_mutex);
+                endpoints[index]->is_healthy = false;
+                const size_t target = find_healthy(index + 1);
+                if (!is_stopping && target != endpoints.size() &&
+                    endpoints[index]->client->move_outbox(*endpoints[target]->client) != 0) {
+                    ++failovers;
+                }
+            }
+            if (on_close) on_close(index);
+        }
+
+    public:
+
+        std::function<void(size_t endpoint)> on_open;
+        std::function<void(size_t endpoint, const std::string &in_message)> on_message;
+        std::function<void(size_t endpoint)> on_close;
+        std::function<void(size_t endpoint, const std::error_code &ec)> on_error;
+
+        /** \brief Функция распределения: номер сервера по ключу
+         *
+         * По умолчанию FNV-1a ключа по модулю числа серверов.
+         * Результат также берется по модулю числа серверов.
+         */
+        std::function<size_t(const std::string &key)> shard_function;
+
+        /** \brief Конструктор класса
+         * \param names         Имена каналов серверов
+         * \param buffer_size   Размер буфера клиентов
+         */
+        explicit BasicShardedNamedPipeClient(
+                const std::vector<std::string> &names,
+                const size_t buffer_size = 1024) {
+            failovers = 0;
+            is_stopping = false;
+            for (const std::string &name : names) {
+                std::unique_ptr<Endpoint> endpoint(new Endpoint());
+                endpoint->client.reset(new Client(name, buffer_size));
+                endpoints.push_back(std::move(endpoint));
+            }
+            const size_t count = endpoints.size();
+            shard_function = [count](const std::string &key) -> size_t {
+                uint64_t hash = 14695981039346656037ULL;
+                for (const char c : key) {
+                    hash ^= static_cast<uint8_t>(c);
+                    hash *= 1099511628211ULL;
+                }
+                return count == 0 ? 0 : static_cast<size_t>(hash % count);
+            };
+        }
+
+        BasicShardedNamedPipeClient(const BasicShardedNamedPipeClient&) = delete;
+        BasicShardedNamedPipeClient &operator=(const BasicShardedNamedPipeClient&) = delete;
+
+        /** \brief Получить клиент сервера
+         *
+         * Через него настраиваются буферы, heartbeat, сжатие и
+         * обработчики двоичных сообщений до запуска.
+         * Обработчики on_open, on_message, on_close и on_error клиента
+         * заменяются при запуске.
+         */
+        inline Client &get_client(const size_t endpoint) {
+            return *endpoints[endpoint]->client;
+        }
+
+        /** \brief Количество серверов
+         */
+        inline size_t size() const noexcept {
+            return endpoints.size();
+        }
+
+        /** \brief Установить паузы проверки упавшего сервера
+         *
+         * Устанавливается до запуска.
+         * \param min_delay Начальная пауза, мс, не меньше 1
+         * \param max_delay Наибольшая пауза, мс
+         */
+        void set_reconnect_backoff(const size_t min_delay, const size_t max_delay) {
+            reconnect_min_delay = std::max(min_delay, (size_t)1);
+            reconnect_max_delay = max_delay;
+        }
+
+        /** \brief Запустить клиенты всех серверов
+         * \return Вернет false, если список серверов пуст или клиент не запустился
+         */
+        bool start() {
+            if (endpoints.empty()) return false;
+            bool is_started = true;
+            for (size_t i = 0; i < endpoints.size(); ++i) {
+                Client &client = *endpoints[i]->client;
+                client.set_reconnect_backoff(reconnect_min_delay, reconnect_max_delay);
+                client.on_open = [this, i]() {
+                    handle_open(i);
+                };
+                client.on_message = [this, i](const std::string &in_message) {
+                    if (on_message) on_message(i, in_message);
+                };
+                client.on_close = [this, i]() {
+                    handle_close(i);
+                };
+                client.on_error = [this, i](const std::error_code &ec) {
+                    if (on_error) on_error(i, ec);
+                };
+                if (!client.start()) is_started = false;
+            }
+            return is_started;
+        }
+
+        /** \brief Получить сервер, которому сейчас уходят сообщения ключа
+         * \return Номер сервера или size(), если доступных серверов нет
+         */
+        size_t get_endpoint(const std::string &key) {
+            if (endpoints.empty()) return 0;
+            std::lock_guard<std::mutex> lock(route_mutex);
+            return find_healthy(shard_function(key) % endpoints.size());
+        }
+
+        /** \brief Отправить сообщение серверу ключа
+         * \param key           Ключ распределения, например символ
+         * \param out_message   Сообщение
+         * \param priority      Приоритет сообщения
+         * \return Вернет false, если нет доступных серверов
+         */
+        bool send(const std::string &key, const std::string &out_message, const Priority priority = Priority::NORMAL) {
+            if (endpoints.empty()) return false;
+            const size_t first = shard_function(key) % endpoints.size();
+            std::lock_guard<std::mutex> lock(route_mutex);
+            for (size_t i = 0; i < endpoints.size(); ++i) {
+                Endpoint &endpoint = *endpoints[(first + i) % endpoints.size()];
+                // соединение могло разорваться до вызова handle_close
+                if (endpoint.is_healthy && endpoint.client->send(out_message, priority)) return true;
+            }
+            return false;
+        }
+
+        /** \brief Проверить, доступен ли сервер
+         */
+        bool check_connect(const size_t endpoint) {
+            std::lock_guard<std::mutex> lock(route_mutex);
+            return endpoints[endpoint]->is_healthy;
+        }
+
+        /** \brief Сколько раз очередь переносилась на другой сервер
+         */
+        inline uint64_t get_failovers() const noexcept {
+            return failovers;
+        }
+
+        /** \brief Остановить клиенты всех серверов
+         */
+        void stop() {
+            is_stopping = true;
+            for (auto &endpoint : endpoints) {
+                endpoint->client->stop();
+            }
+            is_stopping = false;
+        }
+
+        ~BasicShardedNamedPipeClient() {
+            stop();
+        }
+    };
+
+    /** \brief Клиент нескольких серверов с клиентами по умолчанию
+     */
+    using ShardedNamedPipeClient = BasicShardedNamedPipeClient<>;
+}
+
+#endif // SIMPLE_NAMED_PIPE_SHARDED_CLIENT_HPP_INCLUDED
@@ -0,0 +1,156 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_TIMING_WHEEL_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_TIMING_WHEEL_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace SimpleNamedPipe {
+
+    /** \brief Хешированное колесо таймеров
+     *
+     * Таймер - это узел, встроенный в объект-владелец, поэтому установка
+     * и отмена выполняются за O(1) без выделения памяти. Таймеры с задержкой
+     * больше одного оборота колеса остаются в ячейке до своего оборота.
+     * Класс не потокобезопасен, синхронизация остается за владельцем.
+     */
+    class TimingWheel {
+    public:
+
+        /** \brief Узел таймера
+         */
+        class Node {
+        public:
+            Node *prev = nullptr;   /**< Предыдущий узел ячейки */
+            Node *next = nullptr;   /**< Следующий узел ячейки */
+            uint64_t deadline = 0;  /**< Такт срабатывания */
+
+            inline bool is_linked() const noexcept {
+                return prev != nullptr;
+            }
+        };
+
+    private:
+        std::vector<Node> slots;    /**< Ячейки колеса, каждая - голова кольцевого списка */
+        uint64_t mask = 0;
+        uint64_t current_tick = 0;  /**< Последний обработанный такт */
+
+        inline void unlink(Node *node) noexcept {
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = nullptr;
+            node->next = nullptr;
+        }
+
+    public:
+
+        /** \brief Конструктор колеса
+         * \param slots_count Количество ячеек, округляется вверх до степени двойки
+         */
+        explicit TimingWheel(const size_t slots_count = 256) {
+            size_t size = 1;
+            while (size < slots_count) size <<= 1;
+            slots.resize(size);
+            mask = size - 1;
+            for (auto &slot : slots) {
+                slot.prev = &slot;
+                slot.next = &slot;
+            }
+        }
+
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel &operator=(const TimingWheel&) = delete;
+
+        /** \brief Установить таймер
+         * \param node  Узел таймера, ранее установленный таймер переустанавливается
+         * \param delay Задержка в тактах, не меньше одного такта
+         */
+        void schedule(Node *node, const uint64_t delay) noexcept {
+            if (node->is_linked()) unlink(node);
+            node->deadline = current_tick + (delay == 0 ? 1 : delay);
+            Node *head = &slots[node->deadline & mask];
+            node->prev = head->prev;
+            node->next = head;
+            head->prev->next = node;
+            head->prev = node;
+        }
+
+        /** \brief Отменить таймер
+         */
+        inline void cancel(Node *node) noexcept {
+            if (node->is_linked()) unlink(node);
+        }
+
+        /** \brief Продвинуть колесо до указанного такта
+         *
+         * Обработчик может снова установить сработавший таймер.
+         * \param tick      Текущий такт
+         * \param on_expire Обработчик вида void(Node*)
+         */
+        template<class F>
+        void advance(const uint64_t tick, const F &on_expire) {
+            // за один вызов проходим не больше одного оборота
+            if (tick > current_tick + slots.size()) current_tick = tick - slots.size();
+            while (current_tick < tick) {
+                ++current_tick;
+                Node *head = &slots[current_tick & mask];
+                // отсоединяем ячейку целиком: таймеры, установленные обработчиком,
+                // не должны обрабатываться повторно в этом же такте
+                if (head->next == head) continue;
+                Node pending;
+                pending.next = head->next;
+                pending.prev = head->prev;
+                pending.next->prev = &pending;
+                pending.prev->next = &pending;
+                head->next = head;
+                head->prev = head;
+                while (pending.next != &pending) {
+                    Node *node = pending.next;
+                    unlink(node);
+                    if (node->deadline > current_tick) {
+                        // таймер следующего оборота
+                        const uint64_t deadline = node->deadline;
+                        Node *slot = &slots[deadline & mask];
+                        node->prev = slot->prev;
+                        node->next = slot;
+                        slot->prev->next = node;
+                        slot->prev = node;
+                        continue;
+                    }
+                    on_expire(node);
+                }
+            }
+        }
+
+        /** \brief Получить последний обработанный такт
+         */
+        inline uint64_t get_tick() const noexcept {
+            return current_tick;
+        }
+    };
+}
+
+#endif // SIMPLE_NAMED_PIPE_TIMING_WHEEL_HPP_INCLUDED
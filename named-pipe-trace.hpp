@@ -0,0 +1,335 @@
+/*
+* simple-named-pipe-server - C++ server and client library Named Pipe
+*
+* Copyright (c) 2020 Elektro Yar. Email: git.electroyar@gmail.com
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef SIMPLE_NAMED_PIPE_TRACE_HPP_INCLUDED
+#define SIMPLE_NAMED_PIPE_TRACE_HPP_INCLUDED
+
+/** \file
+ * Трассировка этапов прохождения сообщений.
+ *
+ * Включается определением SIMPLE_NAMED_PIPE_TRACE до подключения
+ * заголовков библиотеки. Без этого макроса все точки трассировки
+ * раскрываются в пустые выражения и не влияют на код.
+ */
+
+#include <cstdint>
+
+namespace SimpleNamedPipe {
+
+    /** \brief Этапы жизни сообщения
+     */
+    enum TraceStage {
+        TRACE_ENQUEUE = 0,      /**< Сообщение поставлено в очередь */
+        TRACE_DEQUEUE,          /**< Сообщение взято из очереди */
+        TRACE_WRITE_BEGIN,      /**< Начало WriteFile */
+        TRACE_WRITE_END,        /**< Конец WriteFile */
+        TRACE_READ,             /**< Сообщение прочитано из канала */
+        TRACE_DISPATCH_BEGIN,   /**< Начало обработчика */
+        TRACE_DISPATCH_END,     /**< Конец обработчика */
+    };
+
+    /** \brief Потоки сообщений, старшие биты идентификатора трассировки
+     */
+    enum TraceFlow {
+        TRACE_FLOW_READ = 1,                /**< Входящие сообщения */
+        TRACE_FLOW_SERVER_BROADCAST = 2,    /**< Рассылка send_all, обычная очередь */
+        TRACE_FLOW_SERVER_BROADCAST_HIGH = 3,/**< Рассылка send_all, приоритетная очередь */
+        TRACE_FLOW_CLIENT = 4,              /**< Очередь клиента, обычная */
+        TRACE_FLOW_CLIENT_HIGH = 5,         /**< Очередь клиента, приоритетная */
+        TRACE_FLOW_SERVER_SEND = 6,         /**< Запись в отдельное соединение сервера */
+    };
+}
+
+#ifdef SIMPLE_NAMED_PIPE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#endif
+
+namespace SimpleNamedPipe {
+
+    /** \brief Выборочная трассировка сообщений
+     *
+     * События пишутся в кольцевые буферы отдельных потоков без блокировок
+     * и экспортируются в формате Chrome trace (chrome://tracing, Perfetto).
+     * Время берется из счетчика TSC и пересчитывается в микросекунды при экспорте.
+     * Экспорт выполняется после set_enabled(false).
+     */
+    class Trace {
+    public:
+
+        /** \brief Событие трассировки
+         */
+        class Event {
+        public:
+            uint64_t tsc = 0;       /**< Метка времени */
+            uint64_t id = 0;        /**< Идентификатор сообщения */
+            uint32_t stage = 0;     /**< Этап */
+        };
+
+    private:
+
+        /** \brief Кольцевой буфер событий одного потока
+         */
+        class ThreadBuffer {
+        public:
+            std::vector<Event> events;
+            std::atomic<uint64_t> head;
+            uint32_t tid = 0;
+            std::atomic<bool> is_used;
+
+            explicit ThreadBuffer(const size_t capacity, const uint32_t _tid) :
+                events(capacity), tid(_tid) {
+                head = 0;
+                is_used = true;
+            }
+        };
+
+        /** \brief Общее состояние трассировки
+         */
+        class State {
+        public:
+            std::mutex buffers_mutex;
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+            std::atomic<bool> is_enabled;
+            std::atomic<uint64_t> sample_rate;
+            std::atomic<uint64_t> message_counter;
+            std::atomic<uint64_t> queue_counter;
+            size_t capacity = 65536;
+            uint64_t start_tsc = 0;
+            std::chrono::steady_clock::time_point start_time;
+
+            State() {
+                is_enabled = true;
+                sample_rate = 64;
+                message_counter = 0;
+                queue_counter = 0;
+                start_tsc = get_tsc();
+                start_time = std::chrono::steady_clock::now();
+            }
+        };
+
+        static State &state() {
+            static State instance;
+            return instance;
+        }
+
+        /** \brief Владелец буфера потока, при завершении потока отдает буфер другим потокам
+         */
+        class ThreadSlot {
+        public:
+            std::shared_ptr<ThreadBuffer> buffer;
+
+            ~ThreadSlot() {
+                if (buffer) buffer->is_used = false;
+            }
+        };
+
+        static ThreadBuffer &thread_buffer() {
+            static thread_local ThreadSlot slot;
+            if (!slot.buffer) {
+                State &s = state();
+                std::lock_guard<std::mutex> lock(s.buffers_mutex);
+                for (auto &buffer : s.buffers) {
+                    bool expected = false;
+                    if (buffer->is_used.compare_exchange_strong(expected, true)) {
+                        slot.buffer = buffer;
+                        break;
+                    }
+                }
+                if (!slot.buffer) {
+                    slot.buffer = std::make_shared<ThreadBuffer>(s.capacity, static_cast<uint32_t>(s.buffers.size() + 1));
+                    s.buffers.push_back(slot.buffer);
+                }
+            }
+            return *slot.buffer;
+        }
+
+        static const char *get_stage_name(const uint32_t stage) noexcept {
+            static const char *names[] = {
+                "enqueue", "dequeue", "write", "write", "read", "dispatch", "dispatch"
+            };
+            return stage < (sizeof(names) / sizeof(names[0])) ? names[stage] : "unknown";
+        }
+
+    public:
+
+        /** \brief Прочитать счетчик времени
+         */
+        static inline uint64_t get_tsc() noexcept {
+#           if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#           else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#           endif
+        }
+
+        /** \brief Включить или приостановить запись событий
+         */
+        static inline void set_enabled(const bool enabled) noexcept {
+            state().is_enabled = enabled;
+        }
+
+        /** \brief Трассировать одно сообщение из rate
+         */
+        static inline void set_sample_rate(const uint64_t rate) noexcept {
+            state().sample_rate = rate == 0 ? 1 : rate;
+        }
+
+        /** \brief Получить идентификатор для сообщения из очереди
+         *
+         * Очереди работают по принципу FIFO, поэтому номер сообщения при
+         * постановке и при извлечении совпадает и не хранится в самой очереди.
+         * \param flow  Поток сообщений
+         * \param seq   Номер сообщения в очереди
+         * \return Идентификатор или 0, если сообщение не попало в выборку
+         */
+        static inline uint64_t get_queue_id(const uint64_t flow, const uint64_t seq) noexcept {
+            if ((seq % state().sample_rate) != 0) return 0;
+            return (flow << 56) | (seq & 0x00FFFFFFFFFFFFFFULL);
+        }
+
+        /** \brief Получить начальный номер сообщений новой очереди
+         *
+         * Номера сообщений каждой очереди идут в своем диапазоне из 2^40
+         * номеров, поэтому очереди разных клиентов одного потока сообщений
+         * не дают одинаковых идентификаторов.
+         */
+        static inline uint64_t get_queue_base() noexcept {
+            return (++state().queue_counter & 0xFFFF) << 40;
+        }
+
+        /** \brief Получить идентификатор для сообщения вне очереди
+         * \param flow  Поток сообщений
+         * \return Идентификатор или 0, если сообщение не попало в выборку
+         */
+        static inline uint64_t get_message_id(const uint64_t flow) noexcept {
+            return get_queue_id(flow, ++state().message_counter);
+        }
+
+        /** \brief Записать событие
+         * \param stage Этап
+         * \param id    Идентификатор сообщения, 0 - не записывать
+         */
+        static inline void event(const uint32_t stage, const uint64_t id) noexcept {
+            if (id == 0 || !state().is_enabled) return;
+            ThreadBuffer &buffer = thread_buffer();
+            const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+            Event &e = buffer.events[head % buffer.events.size()];
+            e.tsc = get_tsc();
+            e.id = id;
+            e.stage = stage;
+            buffer.head.store(head + 1, std::memory_order_release);
+        }
+
+        /** \brief Экспортировать события в формате Chrome trace
+         * \param out Поток вывода
+         */
+        static void export_chrome_trace(std::ostream &out) {
+            State &s = state();
+            const double elapsed_us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - s.start_time).count();
+            const uint64_t elapsed_tsc = get_tsc() - s.start_tsc;
+            const double tsc_per_us = (elapsed_us > 0 && elapsed_tsc > 0) ? (elapsed_tsc / elapsed_us) : 1.0;
+
+            out << "{\"traceEvents\":[";
+            bool is_first = true;
+            std::lock_guard<std::mutex> lock(s.buffers_mutex);
+            for (auto &buffer : s.buffers) {
+                const uint64_t head = buffer->head.load(std::memory_order_acquire);
+                const uint64_t size = buffer->events.size();
+                const uint64_t begin = head > size ? head - size : 0;
+                for (uint64_t i = begin; i < head; ++i) {
+                    const Event &e = buffer->events[i % size];
+                    const double ts = static_cast<double>(e.tsc - s.start_tsc) / tsc_per_us;
+                    const char *ph = "i";
+                    switch (e.stage) {
+                    case TRACE_WRITE_BEGIN:
+                    case TRACE_DISPATCH_BEGIN:
+                        ph = "B";
+                        break;
+                    case TRACE_WRITE_END:
+                    case TRACE_DISPATCH_END:
+                        ph = "E";
+                        break;
+                    default:
+                        break;
+                    };
+                    if (!is_first) out << ",";
+                    is_first = false;
+                    out << "{\"name\":\"" << get_stage_name(e.stage)
+                        << "\",\"cat\":\"pipe\",\"ph\":\"" << ph
+                        << "\",\"ts\":" << std::fixed << ts
+                        << ",\"pid\":1,\"tid\":" << buffer->tid;
+                    if (ph[0] == 'i') out << ",\"s\":\"t\"";
+                    out << ",\"args\":{\"id\":" << e.id << "}}";
+                    // стрелка между потоками от постановки в очередь до извлечения
+                    if (e.stage == TRACE_ENQUEUE || e.stage == TRACE_DEQUEUE) {
+                        out << ",{\"name\":\"queue\",\"cat\":\"pipe\",\"ph\":\""
+                            << (e.stage == TRACE_ENQUEUE ? "s" : "f")
+                            << "\",\"bp\":\"e\",\"id\":" << e.id
+                            << ",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << buffer->tid << "}";
+                    }
+                }
+            }
+            out << "]}";
+        }
+
+        /** \brief Сохранить события в файл формата Chrome trace
+         * \param path Путь к файлу
+         * \return Вернет true в случае успеха
+         */
+        static bool save_chrome_trace(const std::string &path) {
+            std::ofstream file(path);
+            if (!file) return false;
+            export_chrome_trace(file);
+            return static_cast<bool>(file);
+        }
+    };
+}
+
+#   define SIMPLE_NAMED_PIPE_TRACE_ID(NAME, VALUE) uint64_t NAME = (VALUE)
+#   define SIMPLE_NAMED_PIPE_TRACE_SET(NAME, VALUE) NAME = (VALUE)
+#   define SIMPLE_NAMED_PIPE_TRACE_EVENT(STAGE, ID) ::SimpleNamedPipe::Trace::event((STAGE), (ID))
+
+#else
+
+#   define SIMPLE_NAMED_PIPE_TRACE_ID(NAME, VALUE)
+#   define SIMPLE_NAMED_PIPE_TRACE_SET(NAME, VALUE)
+#   define SIMPLE_NAMED_PIPE_TRACE_EVENT(STAGE, ID)
+
+#endif // SIMPLE_NAMED_PIPE_TRACE
+
+#endif // SIMPLE_NAMED_PIPE_TRACE_HPP_INCLUDED